@@ -0,0 +1,154 @@
+/*******************************************************************
+    Flashes the built in LED on the beat of the currently playing
+    track.
+
+    The beats, bars and sections of each track are downloaded once
+    with getAudioAnalysis() into a small file on SPIFFS (a few KB
+    instead of the hundreds of KB of JSON Spotify sends), then a
+    SpotifyBeatClock follows along between polls.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "SPIFFS.h"
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/arduino-spotify-api
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543"; // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+#include <ArduinoSpotifyCert.h>
+
+#define ANALYSIS_FILE "/analysis.bin"
+
+#ifndef LED_BUILTIN
+#define LED_BUILTIN 2
+#endif
+
+WiFiClientSecure client;
+ArduinoSpotify spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+// About 5KB, keep it global
+SpotifyBeatClock beatClock;
+
+unsigned long delayBetweenRequests = 5000; // Time between requests (5 seconds)
+unsigned long requestDueTime;              //time when request due
+
+void setup() {
+
+  Serial.begin(115200);
+  pinMode(LED_BUILTIN, OUTPUT);
+
+  if (!SPIFFS.begin()) {
+    Serial.println("SPIFFS initialisation failed!");
+    while (1) yield(); // Stay here twiddling thumbs waiting
+  }
+
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("");
+
+  client.setCACert(spotify_server_cert);
+
+  Serial.println("Refreshing Access Tokens");
+  if (!spotify.refreshAccessToken()) {
+    Serial.println("Failed to get access tokens");
+  }
+}
+
+bool loadAnalysis(const char *trackUri) {
+  // Already have this track?
+  fs::File f = SPIFFS.open(ANALYSIS_FILE, "r");
+  if (f) {
+    bool loaded = beatClock.load(f, trackUri);
+    f.close();
+    if (loaded) {
+      return true;
+    }
+  }
+
+  Serial.println("Downloading the analysis");
+  f = SPIFFS.open(ANALYSIS_FILE, "w");
+  if (!f) {
+    return false;
+  }
+  bool saved = spotify.getAudioAnalysis(trackUri, &f);
+  f.close();
+  if (!saved) {
+    Serial.print("Analysis failed, phase: ");
+    Serial.println(spotify.getLastResult().phase);
+    return false;
+  }
+
+  f = SPIFFS.open(ANALYSIS_FILE, "r");
+  bool loaded = beatClock.load(f, trackUri);
+  f.close();
+  return loaded;
+}
+
+void loop() {
+  if (millis() > requestDueTime)
+  {
+    CurrentlyPlaying *currentlyPlaying = spotify.getCurrentlyPlaying();
+    if (!currentlyPlaying->error)
+    {
+      if (!beatClock.isFor(currentlyPlaying->trackUri)) {
+        loadAnalysis(currentlyPlaying->trackUri);
+        // The download took a while, get a fresh position
+        currentlyPlaying = spotify.getCurrentlyPlaying();
+      }
+      beatClock.sync(currentlyPlaying->progressMs, currentlyPlaying->isPlaying);
+    }
+
+    requestDueTime = millis() + delayBetweenRequests;
+  }
+
+  // On for the first quarter of each beat
+  digitalWrite(LED_BUILTIN, (beatClock.beat() >= 0 && beatClock.beatPhase() < 64) ? HIGH : LOW);
+}
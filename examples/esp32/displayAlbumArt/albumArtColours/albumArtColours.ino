@@ -0,0 +1,165 @@
+/*******************************************************************
+    Works out the main colours of the album art of the currently
+    playing track, e.g. to drive LED strips.
+
+    The art is decoded at the smallest scale and only the colours
+    are kept, there is no framebuffer. Colours are cached by the
+    image URL so going back to an album doesn't download it again.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    If you find what I do useful and would like to support me,
+    please consider becoming a sponsor on Github
+    https://github.com/sponsors/witnessmenow/
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "SPIFFS.h"
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/arduino-spotify-api
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+#include <TJpg_Decoder.h>
+// Library for decoding Jpegs from the API responses
+
+// Search for "tjpg" in the Arduino Library manager
+// https://github.com/Bodmer/TJpg_Decoder
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543"; // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+// Country code, including this is advisable
+#define SPOTIFY_MARKET "IE"
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+#include <ArduinoSpotifyCert.h>
+
+// file name for where to save the image.
+#define ALBUM_ART "/album.jpg"
+
+WiFiClientSecure client;
+ArduinoSpotify spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+SpotifyArtColours artColours;
+
+unsigned long delayBetweenRequests = 10000; // Time between requests (10 seconds)
+unsigned long requestDueTime;               //time when request due
+
+// Called by the decoder with each block of pixels
+bool artOutput(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap)
+{
+  return artColours.pushBlock(x, y, w, h, bitmap);
+}
+
+void setup() {
+
+  Serial.begin(115200);
+
+  if (!SPIFFS.begin()) {
+    Serial.println("SPIFFS initialisation failed!");
+    while (1) yield(); // Stay here twiddling thumbs waiting
+  }
+
+  // A few hundred pixels is plenty to find the colours
+  TJpgDec.setJpgScale(8);
+  TJpgDec.setCallback(artOutput);
+
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(ssid, password);
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("");
+
+  client.setCACert(spotify_server_cert);
+
+  Serial.println("Refreshing Access Tokens");
+  if (!spotify.refreshAccessToken()) {
+    Serial.println("Failed to get access tokens");
+  }
+}
+
+bool updateColours(char *albumArtUrl) {
+  if (artColours.lookup(albumArtUrl)) {
+    Serial.println("Colours were cached");
+    return true;
+  }
+
+  fs::File f = SPIFFS.open(ALBUM_ART, "w");
+  if (!f) {
+    Serial.println("file open failed");
+    return false;
+  }
+  bool gotImage = spotify.getImage(albumArtUrl, &f);
+  f.close();
+  if (!gotImage) {
+    return false;
+  }
+
+  artColours.begin();
+  if (TJpgDec.drawFsJpg(0, 0, ALBUM_ART) != 0) {
+    return false;
+  }
+  return artColours.end(3, albumArtUrl) > 0;
+}
+
+void loop() {
+  if (millis() > requestDueTime)
+  {
+    CurrentlyPlaying *currentlyPlaying = spotify.getCurrentlyPlaying(SPOTIFY_MARKET);
+    if (!currentlyPlaying->error && currentlyPlaying->imgUrl[0] != 0)
+    {
+      if (updateColours(currentlyPlaying->imgUrl)) {
+        for (int i = 0; i < artColours.count(); i++) {
+          const SpotifyColour &colour = artColours.get(i);
+          Serial.print("Colour: ");
+          Serial.print(colour.r);
+          Serial.print(", ");
+          Serial.print(colour.g);
+          Serial.print(", ");
+          Serial.print(colour.b);
+          Serial.print(" share: ");
+          Serial.println(colour.share);
+        }
+      }
+    }
+
+    requestDueTime = millis() + delayBetweenRequests;
+  }
+}
@@ -93,6 +93,13 @@ char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your sp
 // file name for where to save the image.
 #define ALBUM_ART "/album.jpg"
 
+// file name for the shrunk down art, so redrawing the same
+// album doesn't need the jpeg decoded again.
+#define ALBUM_ART_FRAME "/album.bin"
+
+// Set to 0 to keep the full colours
+#define ART_PALETTE_SIZE 16
+
 // so we can compare and not download the same image if we already have it.
 String lastAlbumArtUrl;
 
@@ -106,18 +113,21 @@ unsigned long requestDueTime;               //time when request due
 
 RGB64x32MatrixPanel_I2S_DMA dma_display;
 
-// This next function will be called during decoding of the jpeg file to
-// render each block to the Matrix.  If you use a different display
-// you will need to adapt this function to suit.
-bool displayOutput(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap)
-{
-  // Stop further decoding as image is running off bottom of screen
-  if ( y >= dma_display.height() ) return 0;
+// The art gets shrunk to the size of the matrix while it decodes,
+// this holds the result (24KB for 64 x 64)
+SpotifyArtFrame<64, 64> albumArt;
 
-  dma_display.drawRGBBitmap(x, y, bitmap, w, h);
+// This next function will be called during decoding of the jpeg file
+// with each block of pixels, they get averaged into albumArt.
+bool artOutput(int16_t x, int16_t y, uint16_t w, uint16_t h, uint16_t* bitmap)
+{
+  return albumArt.pushBlock(x, y, w, h, bitmap);
+}
 
-  // Return 1 to decode next block
-  return 1;
+// If you use a different display you will need to adapt this function to suit.
+void drawAlbumArt()
+{
+  dma_display.drawRGBBitmap(0, 0, albumArt.pixels(), albumArt.width(), albumArt.height());
 }
 
 void setup() {
@@ -139,11 +149,8 @@ void setup() {
   dma_display.begin();
   dma_display.fillScreen(dma_display.color565(255, 0, 0));
 
-  // The jpeg image can be scaled by a factor of 1, 2, 4, or 8
-  TJpgDec.setJpgScale(1);
-
   // The decoder must be given the exact name of the rendering function above
-  TJpgDec.setCallback(displayOutput);
+  TJpgDec.setCallback(artOutput);
 
   // The byte order can be swapped (set true for TFT_eSPI)
   //TJpgDec.setSwapBytes(true);
@@ -173,8 +180,25 @@ void setup() {
     Serial.println("Failed to get access tokens");
   }
 }
+bool loadCachedArt(char *albumArtUrl) {
+  if (!SPIFFS.exists(ALBUM_ART_FRAME)) {
+    return false;
+  }
+  fs::File f = SPIFFS.open(ALBUM_ART_FRAME, "r");
+  // Fails if the saved frame is for a different image
+  bool loaded = albumArt.loadFrom(f, albumArtUrl);
+  f.close();
+  return loaded;
+}
+
 int displayImage(char *albumArtUrl) {
 
+  if (loadCachedArt(albumArtUrl)) {
+    Serial.println("Using cached art");
+    drawAlbumArt();
+    return 0;
+  }
+
   // In this example I reuse the same filename
   // over and over, maybe saving the art using
   // the album URI as the name would be better
@@ -196,11 +220,37 @@ int displayImage(char *albumArtUrl) {
   // Make sure to close the file!
   f.close();
 
-  if (gotImage) {
-    return TJpgDec.drawFsJpg(0, 0, ALBUM_ART);
-  } else {
+  if (!gotImage) {
     return -2;
   }
+
+  // Decode at the smallest size that still covers the matrix,
+  // the frame averages it down the rest of the way.
+  uint16_t jpgWidth, jpgHeight;
+  TJpgDec.getFsJpgSize(&jpgWidth, &jpgHeight, ALBUM_ART);
+  uint8_t scale = spotifyArtJpegScale(jpgWidth, jpgHeight, albumArt.width(), albumArt.height());
+  TJpgDec.setJpgScale(scale);
+  if (!albumArt.begin(jpgWidth, jpgHeight, scale)) {
+    return -3;
+  }
+
+  int result = TJpgDec.drawFsJpg(0, 0, ALBUM_ART);
+  if (result != 0) {
+    return result;
+  }
+  albumArt.end();
+
+#if ART_PALETTE_SIZE > 0
+  albumArt.quantize(ART_PALETTE_SIZE);
+#endif
+  drawAlbumArt();
+
+  fs::File cache = SPIFFS.open(ALBUM_ART_FRAME, "w");
+  if (cache) {
+    albumArt.saveTo(cache, albumArtUrl);
+    cache.close();
+  }
+  return 0;
 }
 
 void printCurrentlyPlayingToSerial(CurrentlyPlaying currentlyPlaying)
@@ -0,0 +1,166 @@
+/*******************************************************************
+    Polls Spotify once and shares what's playing with all the
+    displays on your network, run the gatewayDisplay example on
+    them. However many displays there are, the account only
+    sees this one board polling.
+
+    Snapshots are sent to a multicast group over UDP and the
+    album art is downloaded once to SPIFFS and served to the
+    displays over TCP.
+
+    NOTE: You need to get a Refresh token to use this example
+    Use the getRefreshToken example to get it.
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <WiFiUdp.h>
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "SPIFFS.h"
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+#include <ArduinoSpotifyGateway.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/arduino-spotify-api
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define SPOTIFY_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+
+//------- ---------------------- ------
+
+// The displays join the same group
+IPAddress multicastGroup(239, 255, 42, 42);
+
+#define ART_FILE "/gateway_art.jpg"
+
+// including a "spotify_server_cert" variable
+// header is included as part of the ArduinoSpotify libary
+#include <ArduinoSpotifyCert.h>
+
+WiFiClientSecure client;
+ArduinoSpotify spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
+
+WiFiUDP udp;
+WiFiServer artServer(SPOTIFY_GATEWAY_PORT);
+SpotifyGateway gateway(spotify, udp, multicastGroup);
+
+// The art we last tried to download, and whether it worked
+uint32_t artKey = 0;
+bool artReady = false;
+long artLength = 0;
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    if (!SPIFFS.begin(true))
+    {
+        Serial.println("SPIFFS initialisation failed!");
+        while (1)
+            yield(); // Stay here twiddling thumbs waiting
+    }
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    client.setCACert(spotify_server_cert);
+
+    artServer.begin();
+
+    Serial.println("Refreshing Access Tokens");
+    if (!spotify.refreshAccessToken())
+    {
+        Serial.println("Failed to get access tokens");
+    }
+}
+
+void downloadArt()
+{
+    fs::File f = SPIFFS.open(ART_FILE, "w+");
+    if (!f)
+    {
+        Serial.println("file open failed");
+        return;
+    }
+
+    // Not tried again until the art changes, the displays get told no
+    artKey = gateway.artKey();
+    artReady = spotify.getImage(spotify.currentlyPlaying.imgUrl, &f);
+    artLength = f.size();
+    f.close();
+}
+
+void loop()
+{
+    // Polls every 5 seconds, and sends the snapshot again every
+    // SPOTIFY_GATEWAY_REPEAT_MS for displays that missed it
+    if (gateway.loop(5000))
+    {
+        Serial.print("Now playing: ");
+        Serial.println(spotify.currentlyPlaying.trackName);
+    }
+
+    if (gateway.artKey() != 0 && gateway.artKey() != artKey)
+    {
+        downloadArt();
+    }
+
+    WiFiClient display = artServer.available();
+    if (display)
+    {
+        if (artReady && artKey == gateway.artKey())
+        {
+            fs::File f = SPIFFS.open(ART_FILE, "r");
+            gateway.serveArt(display, f, artLength);
+            f.close();
+        }
+        else
+        {
+            display.stop();
+        }
+    }
+}
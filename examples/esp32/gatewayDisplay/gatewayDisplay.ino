@@ -0,0 +1,136 @@
+/*******************************************************************
+    A display that gets what's playing from the gateway example
+    instead of from Spotify, so it needs no Spotify account
+    details and adds nothing to the account's API usage.
+
+    The album art is fetched from the gateway when it changes
+    and saved to SPIFFS, ready to be drawn like in the
+    displayAlbumArt examples.
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "SPIFFS.h"
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+#include <ArduinoSpotifyGateway.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/arduino-spotify-api
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+//------- ---------------------- ------
+
+// Same group as the gateway
+IPAddress multicastGroup(239, 255, 42, 42);
+
+#define ART_FILE "/album.jpg"
+
+WiFiUDP udp;
+WiFiClient client;
+SpotifySubscriber subscriber(udp);
+
+uint32_t artKey = 0;
+
+void setup()
+{
+
+    Serial.begin(115200);
+
+    if (!SPIFFS.begin(true))
+    {
+        Serial.println("SPIFFS initialisation failed!");
+        while (1)
+            yield(); // Stay here twiddling thumbs waiting
+    }
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    Serial.println("");
+
+    // Wait for connection
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("Connected to ");
+    Serial.println(ssid);
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    udp.beginMulticast(multicastGroup, SPOTIFY_GATEWAY_PORT);
+}
+
+void loop()
+{
+    if (subscriber.loop())
+    {
+        CurrentlyPlaying &currentlyPlaying = subscriber.currentlyPlaying;
+        if (!currentlyPlaying.error)
+        {
+            Serial.print("Track: ");
+            Serial.println(currentlyPlaying.trackName);
+            Serial.print("Artist: ");
+            Serial.println(currentlyPlaying.firstArtistName);
+        }
+        else
+        {
+            Serial.println("Nothing playing");
+        }
+    }
+
+    if (subscriber.connected() && subscriber.artKey() != 0 && subscriber.artKey() != artKey)
+    {
+        fs::File f = SPIFFS.open(ART_FILE, "w+");
+        if (f)
+        {
+            // The gateway may still be downloading it, so if this fails
+            // it's tried again next time round
+            bool gotArt = subscriber.getImage(client, &f);
+            f.close();
+            if (gotArt)
+            {
+                artKey = subscriber.artKey();
+                Serial.println("Got the album art");
+            }
+        }
+    }
+
+    // The progress carries on between snapshots
+    static unsigned long printedAt = 0;
+    if (subscriber.connected() && millis() - printedAt > 1000)
+    {
+        printedAt = millis();
+        Serial.print("Progress: ");
+        Serial.println(subscriber.progressMs());
+    }
+}
@@ -6,6 +6,10 @@
     NOTE: You need to get a Refresh token to use this example
     Use the getRefreshToken example to get it.
 
+    NOTE: The device list is optional, uncomment SPOTIFY_DEVICE_LIST
+    in ArduinoSpotify.h (or add -DSPOTIFY_DEVICE_LIST to your build
+    flags) to use this example.
+
     Parts:
     ESP32 D1 Mini stlye Dev board* - http://s.click.aliexpress.com/e/C6ds4my
 
@@ -37,6 +41,10 @@
 #include <ArduinoSpotify.h>
 // Library for connecting to the Spotify API
 
+#ifndef SPOTIFY_DEVICE_LIST
+#error "Add -DSPOTIFY_DEVICE_LIST to your build flags or uncomment it in ArduinoSpotify.h for this example"
+#endif
+
 // Install from Github
 // https://github.com/witnessmenow/arduino-spotify-api
 
@@ -62,8 +70,6 @@ char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your sp
 
 //------- ---------------------- ------
 
-#define SPOTIFY_MAX_DEVICES 5 // Number of devices you want to try parse
-
 // including a "spotify_server_cert" variable
 // header is included as part of the ArduinoSpotify libary
 #include <ArduinoSpotifyCert.h>
@@ -74,8 +80,6 @@ ArduinoSpotify spotify(client, clientId, clientSecret, SPOTIFY_REFRESH_TOKEN);
 unsigned long delayBetweenRequests = 60000; // Time between requests (1 minute)
 unsigned long requestDueTime;               //time when request due
 
-SpotifyDevice* deviceList;
-
 void setup() {
 
   Serial.begin(115200);
@@ -100,16 +104,8 @@ void setup() {
   // If you want to enable some extra debugging
   // uncomment the "#define SPOTIFY_DEBUG" in ArduinoSpotify.h
 
-  //spotify.getDevicesBufferSize = 2000; //can be adjusted, needs about 300 per device, defaults to 2000
-  // Remember this is all devices returned by spotify, not just the max you want to return
-
-  //inits an empty array of devices, required for the getDevices method
-  deviceList = spotify.generateDevicesArray(SPOTIFY_MAX_DEVICES);
-
-  // This allocates a decent chunk of memory
-  // If you want to free it up you can use
-  // spotify.destroyDevicesArray(deviceList,SPOTIFY_MAX_DEVICES);
-  // but you will need generate a new one if you want to get devices again
+  // The library keeps up to SPOTIFY_MAX_DEVICES devices (6 by default),
+  // set it in your build flags if you have more
 
   Serial.println("Refreshing Access Tokens");
   if (!spotify.refreshAccessToken()) {
@@ -117,7 +113,7 @@ void setup() {
   }
 }
 
-void printDeviceToSerial(SpotifyDevice device)
+void printDeviceToSerial(const SpotifyDevice &device)
 {
 
   Serial.println("--------- Device Details ---------");
@@ -168,12 +164,19 @@ void loop() {
     Serial.println(ESP.getFreeHeap());
 
     Serial.println("Getting devices:");
-    // Market can be excluded if you want e.g. spotify.getPlayerDetails()
-    int numDevices = spotify.getDevices(deviceList, SPOTIFY_MAX_DEVICES);
+    // true fetches a fresh list, otherwise it's only fetched when the
+    // cached one is more than SPOTIFY_DEVICE_CACHE_MS old
+    int numDevices = spotify.getDevices(true);
     for (int i = 0; i < numDevices; i++) {
-      printDeviceToSerial(deviceList[i]);
-      spotify.transferPlayback(deviceList[i].id, true); //true means to play after transfer
-      delay(5000);
+      printDeviceToSerial(spotify.getDevice(i));
+    }
+
+    // The controls take a device name (or type) as well as an id, the
+    // id comes from the list above so this doesn't need another request
+    if (numDevices > 0) {
+      Serial.print("Playing on: ");
+      Serial.println(spotify.getDevice(0).name);
+      spotify.play(spotify.getDevice(0).name);
     }
 
     requestDueTime = millis() + delayBetweenRequests;
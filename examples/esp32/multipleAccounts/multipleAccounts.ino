@@ -0,0 +1,123 @@
+/*******************************************************************
+    Polls what is playing on several Spotify accounts using one
+    ArduinoSpotify object, one client and one parse buffer.
+
+    Each account only needs a SpotifySession (its credentials and
+    tokens), so adding a zone costs a few hundred bytes instead of
+    another full library instance.
+
+    NOTE: You need to get a Refresh token for each account to use
+    this example. Use the getRefreshToken example to get them.
+
+    Parts:
+    ESP32 D1 Mini stlye Dev board* - http://s.click.aliexpress.com/e/C6ds4my
+
+ *  * = Affilate
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+// Library for connecting to the Spotify API
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+//------- Replace the following! ------
+
+char ssid[] = "SSID";         // your network SSID (name)
+char password[] = "password"; // your network password
+
+char clientId[] = "56t4373258u3405u43u543";     // Your client ID of your spotify APP
+char clientSecret[] = "56t4373258u3405u43u543"; // Your client Secret of your spotify APP (Do Not share this!)
+
+#define BAR_REFRESH_TOKEN "AAAAAAAAAABBBBBBBBBBBCCCCCCCCCCCDDDDDDDDDDD"
+#define LOUNGE_REFRESH_TOKEN "EEEEEEEEEEFFFFFFFFFFFGGGGGGGGGGGHHHHHHHHHHH"
+#define TERRACE_REFRESH_TOKEN "IIIIIIIIIIJJJJJJJJJJJKKKKKKKKKKKLLLLLLLLLLL"
+
+//------- ---------------------- ------
+
+#include <ArduinoSpotifyCert.h>
+
+WiFiClientSecure client;
+ArduinoSpotify spotify(client);
+
+SpotifySession bar;
+SpotifySession lounge;
+SpotifySession terrace;
+
+unsigned long delayBetweenRequests = 10000; // Time between requests (10 seconds)
+unsigned long requestDueTime;               //time when request due
+
+void setup()
+{
+    Serial.begin(115200);
+
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(ssid, password);
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+
+    client.setCACert(spotify_server_cert);
+
+    // The bar gets polled twice as often as the other two
+    spotify.setupSession(bar, clientId, clientSecret, BAR_REFRESH_TOKEN, 1);
+    spotify.setupSession(lounge, clientId, clientSecret, LOUNGE_REFRESH_TOKEN);
+    spotify.setupSession(terrace, clientId, clientSecret, TERRACE_REFRESH_TOKEN);
+    spotify.addSession(bar);
+    spotify.addSession(lounge);
+    spotify.addSession(terrace);
+
+    // Tokens are fetched the first time each session is used
+}
+
+const char *zoneName(SpotifySession *session)
+{
+    if (session == &bar)
+    {
+        return "Bar";
+    }
+    if (session == &lounge)
+    {
+        return "Lounge";
+    }
+    return "Terrace";
+}
+
+void loop()
+{
+    if (millis() > requestDueTime)
+    {
+        SpotifySession *session = spotify.nextSession();
+
+        CurrentlyPlaying *currentlyPlaying = spotify.getCurrentlyPlaying();
+        Serial.print(zoneName(session));
+        Serial.print(": ");
+        if (!currentlyPlaying->error)
+        {
+            Serial.print(currentlyPlaying->trackName);
+            Serial.print(" - ");
+            Serial.println(currentlyPlaying->firstArtistName);
+        }
+        else
+        {
+            Serial.print("nothing playing or failed, status ");
+            Serial.println(spotify.getLastResult().httpStatus);
+        }
+
+        requestDueTime = millis() + delayBetweenRequests;
+    }
+}
@@ -0,0 +1,270 @@
+/*******************************************************************
+    Replays recorded API responses through the parsing code and
+    reports how fast it is and how much of the JSON document the
+    responses need.
+
+    Use it to check SPOTIFY_JSON_DOC_SIZE (and the other sizes in
+    ArduinoSpotify.h) against real responses before shipping a
+    change: long track names, tracks available in lots of markets,
+    podcast episodes and so on. It prints FAIL if any response
+    doesn't fit or fails to parse, on any of the iterations.
+
+    Put the responses on SPIFFS in /corpus, one raw HTTP response
+    (status line, headers and body) per file, named after the call
+    that made them:
+      /corpus/currently_<anything>   getCurrentlyPlaying()
+      /corpus/player_<anything>      getPlayerDetails()
+      /corpus/devices_<anything>     scanDevices()
+      /corpus/features_<anything>    getAudioFeatures()
+      /corpus/analysis_<anything>    getAudioAnalysis()
+      /corpus/state_<anything>       getPlayerState()
+      /corpus/search_<anything>      search()
+      /corpus/queue_<anything>       getQueue() (needs SPOTIFY_UP_NEXT)
+
+    The data folder of this example has a response of each kind to
+    start from, upload it with the ESP32 Sketch Data Upload tool.
+    They are made up but shaped like the real thing, including the
+    long available_markets lists and a queue of 20 tracks.
+
+    To record them, wrap your client in a SpotifyRecordingClient
+    (from ArduinoSpotifyReplay.h) and pass a file to record() before
+    each call:
+      SpotifyRecordingClient recorder(client);
+      ArduinoSpotify spotify(recorder, clientId, clientSecret, refreshToken);
+      ...
+      recorder.record(&file);
+      spotify.getCurrentlyPlaying();
+      recorder.record(NULL);
+
+    No WiFi is needed to run this.
+
+    Written by Brian Lough
+    YouTube: https://www.youtube.com/brianlough
+    Tindie: https://www.tindie.com/stores/brianlough/
+    Twitter: https://twitter.com/witnessmenow
+ *******************************************************************/
+
+// ----------------------------
+// Standard Libraries
+// ----------------------------
+
+#define FS_NO_GLOBALS
+#include <FS.h>
+#include "SPIFFS.h"
+
+// ----------------------------
+// Additional Libraries - each one of these will need to be installed.
+// ----------------------------
+
+#include <ArduinoSpotify.h>
+#include <ArduinoSpotifyReplay.h>
+// Library for connecting to the Spotify API
+
+// Install from Github
+// https://github.com/witnessmenow/arduino-spotify-api
+
+#include <ArduinoJson.h>
+// Library used for parsing Json from the API responses
+
+// Search for "Arduino Json" in the Arduino Library manager
+// https://github.com/bblanchon/ArduinoJson
+
+#define CORPUS_DIR "/corpus"
+
+// Each response is parsed this many times for the timings
+#define ITERATIONS 20
+
+// Anything will do, it only stops the library asking for a token
+char bearerToken[] = "replay";
+
+SpotifyReplayClient replay;
+ArduinoSpotify spotify(replay, bearerToken);
+
+// getAudioAnalysis() output goes nowhere
+class NullPrint : public Print
+{
+public:
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *, size_t size) { return size; }
+};
+NullPrint nullPrint;
+
+// search() hands its results over here
+int searchResults = 0;
+void countResult(ArduinoSpotify &spotify, const SpotifySearchResult &result, uint8_t index)
+{
+  searchResults++;
+}
+
+// Returns false if the response didn't fit or failed on any iteration
+bool replayResponse(const char *name)
+{
+  unsigned long totalUs = 0;
+  unsigned long worstUs = 0;
+  uint32_t heapBefore = ESP.getFreeHeap();
+  spotify.resetDocumentPeak();
+  searchResults = 0;
+  // The first iteration that went wrong, if any
+  SpotifyResult failure;
+  int failedIteration = -1;
+
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    fs::File f = SPIFFS.open(name, "r");
+    replay.setResponse(&f);
+
+    unsigned long start = micros();
+    if (strstr(name, "/currently_") != NULL)
+    {
+      spotify.getCurrentlyPlaying();
+    }
+    else if (strstr(name, "/player_") != NULL)
+    {
+      spotify.getPlayerDetails();
+    }
+    else if (strstr(name, "/devices_") != NULL)
+    {
+      spotify.scanDevices();
+    }
+    else if (strstr(name, "/features_") != NULL)
+    {
+      spotify.getAudioFeatures("replay");
+    }
+    else if (strstr(name, "/analysis_") != NULL)
+    {
+      spotify.getAudioAnalysis("replay", &nullPrint);
+    }
+    else if (strstr(name, "/state_") != NULL)
+    {
+      spotify.getPlayerState();
+    }
+    else if (strstr(name, "/search_") != NULL)
+    {
+      spotify.search("replay", "track,album,artist", 10, countResult);
+    }
+#ifdef SPOTIFY_UP_NEXT
+    else if (strstr(name, "/queue_") != NULL)
+    {
+      spotify.getQueue();
+    }
+#endif
+    else
+    {
+      f.close();
+      Serial.print("Skipping ");
+      Serial.println(name);
+      return true;
+    }
+    unsigned long took = micros() - start;
+    f.close();
+
+    if (failedIteration < 0 && !spotify.getLastResult())
+    {
+      failure = spotify.getLastResult();
+      failedIteration = i;
+    }
+
+    totalUs += took;
+    if (took > worstUs)
+    {
+      worstUs = took;
+    }
+  }
+
+  const SpotifyResult &result = (failedIteration >= 0) ? failure : spotify.getLastResult();
+  bool overflowed = result.jsonError == DeserializationError::NoMemory;
+
+  Serial.print(result ? "ok   " : "FAIL ");
+  Serial.print(name);
+  Serial.print(" status: ");
+  Serial.print(result.httpStatus);
+  Serial.print(" avg us: ");
+  Serial.print(totalUs / ITERATIONS);
+  Serial.print(" worst us: ");
+  Serial.print(worstUs);
+  Serial.print(" per sec: ");
+  Serial.print(totalUs > 0 ? (1000000.0 * ITERATIONS / totalUs) : 0);
+  Serial.print(" doc: ");
+  Serial.print(spotify.getDocumentPeak());
+  Serial.print("/");
+  Serial.print(SPOTIFY_JSON_DOC_SIZE);
+  if (searchResults > 0)
+  {
+    // Search is scanned, so the doc tells nothing about it
+    Serial.print(" results: ");
+    Serial.print(searchResults / ITERATIONS);
+  }
+  // The library shouldn't allocate, anything here is worth a look
+  Serial.print(" heap change: ");
+  Serial.println((int32_t)heapBefore - (int32_t)ESP.getFreeHeap());
+  if (!result)
+  {
+    Serial.print("     iteration: ");
+    Serial.print(failedIteration);
+    Serial.print(" phase: ");
+    Serial.print(result.phase);
+    Serial.print(" ");
+    Serial.print(result.jsonError.c_str());
+    Serial.println(overflowed ? " (raise SPOTIFY_JSON_DOC_SIZE)" : "");
+  }
+
+  return result;
+}
+
+void setup()
+{
+  Serial.begin(115200);
+
+  if (!SPIFFS.begin())
+  {
+    Serial.println("SPIFFS initialisation failed!");
+    while (1) yield(); // Stay here twiddling thumbs waiting
+  }
+
+  int responses = 0;
+  int failures = 0;
+  size_t worstDoc = 0;
+  unsigned long start = millis();
+
+  // SPIFFS has no real folders, the whole path is the name
+  fs::File root = SPIFFS.open("/");
+  fs::File entry = root.openNextFile();
+  while (entry)
+  {
+    String name = String(entry.name());
+    entry.close();
+    if (!name.startsWith("/"))
+    {
+      name = "/" + name;
+    }
+    if (name.startsWith(CORPUS_DIR "/"))
+    {
+      responses++;
+      if (!replayResponse(name.c_str()))
+      {
+        failures++;
+      }
+      if (spotify.getDocumentPeak() > worstDoc)
+      {
+        worstDoc = spotify.getDocumentPeak();
+      }
+    }
+    entry = root.openNextFile();
+  }
+
+  Serial.println("------------------------");
+  Serial.print("Responses: ");
+  Serial.print(responses);
+  Serial.print(" in ");
+  Serial.print(millis() - start);
+  Serial.println("ms");
+  Serial.print("Worst document usage: ");
+  Serial.print(worstDoc);
+  Serial.print("/");
+  Serial.println(SPOTIFY_JSON_DOC_SIZE);
+  Serial.println(failures == 0 ? "PASS" : "FAIL");
+}
+
+void loop()
+{
+}
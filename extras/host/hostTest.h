@@ -0,0 +1,125 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Bits shared by the host tests
+
+#ifndef hostTest_h
+#define hostTest_h
+
+#include <Arduino.h>
+
+#include <dirent.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                 \
+    do                                                                   \
+    {                                                                    \
+        if (!(condition))                                                \
+        {                                                                \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                  \
+        }                                                                \
+    } while (0)
+
+// Hands out a buffer a few bytes at a time, like a socket would
+class BufferStream : public Stream
+{
+public:
+    BufferStream(const std::string &data) : _data(data), _offset(0)
+    {
+        // Nothing more is coming once it's empty, don't wait for it
+        setTimeout(0);
+    }
+
+    int available()
+    {
+        size_t left = _data.size() - _offset;
+        return left < 61 ? left : 61;
+    }
+    int read()
+    {
+        return _offset < _data.size() ? (uint8_t)_data[_offset++] : -1;
+    }
+    int peek()
+    {
+        return _offset < _data.size() ? (uint8_t)_data[_offset] : -1;
+    }
+    size_t write(uint8_t) { return 0; }
+
+private:
+    std::string _data;
+    size_t _offset;
+};
+
+static inline std::string readFile(const std::string &path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// Compresses data the way a server sending "Content-Encoding: gzip" would
+static inline std::string gzip(const std::string &data, int level)
+{
+    z_stream z = z_stream();
+    // 15 bits of window plus 16 for the gzip wrapper
+    deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&z, data.size()), 0);
+    z.next_in = (Bytef *)data.data();
+    z.avail_in = data.size();
+    z.next_out = (Bytef *)&out[0];
+    z.avail_out = out.size();
+    deflate(&z, Z_FINISH);
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+// Names of the files in a folder, sorted, empty if it can't be read
+static inline std::vector<std::string> listFolder(const char *path)
+{
+    std::vector<std::string> names;
+    DIR *folder = opendir(path);
+    if (folder == NULL)
+    {
+        return names;
+    }
+    while (struct dirent *entry = readdir(folder))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(folder);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+#endif
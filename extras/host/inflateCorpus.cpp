@@ -0,0 +1,96 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Gzips the body of every response in the replay benchmark's corpus,
+// at a few compression levels, and checks SpotifyInflateStream gives
+// back exactly the same bytes.
+
+#include <Arduino.h>
+#include "ArduinoSpotifyDecode.h"
+#include "hostTest.h"
+
+// The corpus files are whole HTTP responses, the body is after the
+// blank line
+static std::string readBody(const std::string &path)
+{
+    std::string response = readFile(path);
+    size_t headersEnd = response.find("\r\n\r\n");
+    if (headersEnd == std::string::npos)
+    {
+        return std::string();
+    }
+    return response.substr(headersEnd + 4);
+}
+
+static SpotifyInflateStream inflater;
+
+static void checkBody(const std::string &name, const std::string &body, int level)
+{
+    BufferStream source(gzip(body, level));
+    inflater.begin(source);
+
+    std::string out;
+    int c;
+    while ((c = inflater.read()) >= 0)
+    {
+        out += (char)c;
+    }
+
+    bool ok = !inflater.failed() && inflater.finished() && out == body;
+    printf("%-20s level %d: %zu -> %lu bytes, inflated %zu%s\n", name.c_str(), level,
+           body.size(), inflater.compressedBytes(), out.size(), ok ? "" : " FAILED");
+    CHECK(!inflater.failed());
+    CHECK(inflater.finished());
+    CHECK(out == body);
+    CHECK(inflater.inflatedBytes() == body.size());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: inflateCorpus <corpus folder>\n");
+        return 2;
+    }
+
+    std::vector<std::string> names = listFolder(argv[1]);
+    if (names.empty())
+    {
+        printf("Nothing in %s\n", argv[1]);
+        return 2;
+    }
+
+    const int levels[] = {1, 6, 9};
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        std::string body = readBody(std::string(argv[1]) + "/" + names[i]);
+        CHECK(!body.empty());
+        for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++)
+        {
+            checkBody(names[i], body, levels[l]);
+        }
+    }
+
+    if (failures == 0)
+    {
+        printf("All passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,397 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Checks SpotifyPosixClient against stand-in servers on the loopback
+// interface: a TLS one with a made up certificate for api.spotify.com,
+// reached with redirect(), and a plain TCP one.
+
+#include <Arduino.h>
+#include "ArduinoSpotifyPosix.h"
+#include "hostTest.h"
+
+#include <arpa/inet.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include <string>
+#include <thread>
+
+// Self signed certificate for host, written to a temp file so the
+// client can be given it as its CA
+struct TestCertificate
+{
+    EVP_PKEY *key;
+    X509 *cert;
+    char path[64];
+
+    TestCertificate(const char *host) : key(NULL), cert(NULL)
+    {
+        EVP_PKEY_CTX *keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+        EVP_PKEY_keygen_init(keyContext);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1);
+        EVP_PKEY_keygen(keyContext, &key);
+        EVP_PKEY_CTX_free(keyContext);
+
+        cert = X509_new();
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME *name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)host, -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+
+        X509V3_CTX context;
+        X509V3_set_ctx_nodb(&context);
+        X509V3_set_ctx(&context, cert, cert, NULL, NULL, 0);
+        std::string altName = std::string("DNS:") + host;
+        X509_EXTENSION *extension = X509V3_EXT_conf_nid(NULL, &context, NID_subject_alt_name, altName.c_str());
+        X509_add_ext(cert, extension, -1);
+        X509_EXTENSION_free(extension);
+        extension = X509V3_EXT_conf_nid(NULL, &context, NID_basic_constraints, "critical,CA:TRUE");
+        X509_add_ext(cert, extension, -1);
+        X509_EXTENSION_free(extension);
+        X509_sign(cert, key, EVP_sha256());
+
+        strcpy(path, "/tmp/spotifyPosixCertXXXXXX");
+        int fd = mkstemp(path);
+        FILE *file = fdopen(fd, "w");
+        PEM_write_X509(file, cert);
+        fclose(file);
+    }
+
+    ~TestCertificate()
+    {
+        unlink(path);
+        X509_free(cert);
+        EVP_PKEY_free(key);
+    }
+};
+
+// Answers one connection with a canned response, sent in small pieces so
+// the client has to put reads together
+class StandInServer
+{
+public:
+    StandInServer(SSL_CTX *tls) : _tls(tls), _port(0), _handshakeOk(false)
+    {
+        _listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        bind(_listener, (struct sockaddr *)&address, sizeof(address));
+        listen(_listener, 1);
+        socklen_t length = sizeof(address);
+        getsockname(_listener, (struct sockaddr *)&address, &length);
+        _port = ntohs(address.sin_port);
+    }
+
+    ~StandInServer()
+    {
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+        close(_listener);
+    }
+
+    uint16_t port() const { return _port; }
+
+    // silent accepts but never answers
+    void serve(const std::string &response, bool silent = false)
+    {
+        _thread = std::thread(&StandInServer::run, this, response, silent);
+    }
+
+    void wait()
+    {
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+    }
+
+    std::string request;
+    std::string serverName;
+    bool handshakeOk() const { return _handshakeOk; }
+
+private:
+    void run(std::string response, bool silent)
+    {
+        int fd = accept(_listener, NULL, NULL);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct timeval timeout = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        SSL *ssl = NULL;
+        if (_tls != NULL)
+        {
+            ssl = SSL_new(_tls);
+            SSL_set_fd(ssl, fd);
+            if (SSL_accept(ssl) != 1)
+            {
+                SSL_free(ssl);
+                close(fd);
+                return;
+            }
+            const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+            serverName = (name != NULL) ? name : "";
+        }
+        _handshakeOk = true;
+
+        char buffer[512];
+        while (request.find("\r\n\r\n") == std::string::npos)
+        {
+            int got = (ssl != NULL) ? SSL_read(ssl, buffer, sizeof(buffer)) : recv(fd, buffer, sizeof(buffer), 0);
+            if (got <= 0)
+            {
+                break;
+            }
+            request.append(buffer, got);
+        }
+
+        if (silent)
+        {
+            // Long enough for the client's read to time out
+            usleep(600 * 1000);
+        }
+        else
+        {
+            for (size_t sent = 0; sent < response.size(); sent += 700)
+            {
+                size_t piece = std::min((size_t)700, response.size() - sent);
+                if (ssl != NULL)
+                {
+                    SSL_write(ssl, response.data() + sent, piece);
+                }
+                else
+                {
+                    send(fd, response.data() + sent, piece, MSG_NOSIGNAL);
+                }
+                if (sent % 7000 == 0)
+                {
+                    usleep(1000);
+                }
+            }
+        }
+
+        if (ssl != NULL)
+        {
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+        }
+        close(fd);
+    }
+
+    SSL_CTX *_tls;
+    int _listener;
+    uint16_t _port;
+    bool _handshakeOk;
+    std::thread _thread;
+};
+
+static std::string makeResponse(std::string &body)
+{
+    body.clear();
+    for (int i = 0; i < 60000; i++)
+    {
+        body += (char)('a' + (i * 7) % 26);
+    }
+    char headers[128];
+    snprintf(headers, sizeof(headers), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %u\r\n\r\n", (unsigned)body.size());
+    return headers + body;
+}
+
+// Sends a GET and reads the response like the library does: status and
+// headers through the Stream helpers, the body in bulk
+static bool fetch(SpotifyPosixClient &client, const char *host, uint16_t port, std::string &body)
+{
+    if (!client.connect(host, port))
+    {
+        return false;
+    }
+    client.print(F("GET /v1/me/player HTTP/1.1\r\nHost: "));
+    client.print(host);
+    client.print(F("\r\nConnection: close\r\n\r\n"));
+
+    char status[32] = {0};
+    client.readBytesUntil('\r', status, sizeof(status) - 1);
+    if (strcmp(status, "HTTP/1.1 200 OK") != 0 || !client.find("\r\n\r\n"))
+    {
+        return false;
+    }
+
+    body.clear();
+    uint8_t buffer[256];
+    while (client.connected())
+    {
+        int got = client.read(buffer, sizeof(buffer));
+        if (got > 0)
+        {
+            body.append((const char *)buffer, got);
+        }
+    }
+    client.stop();
+    return true;
+}
+
+static void testInsecureRedirect(SSL_CTX *tls)
+{
+    StandInServer server(tls);
+    std::string expected;
+    server.serve(makeResponse(expected));
+
+    SpotifyPosixClient client;
+    client.setTimeout(2000);
+    client.setInsecure();
+    client.redirect("127.0.0.1", server.port());
+    std::string body;
+    CHECK(fetch(client, "api.spotify.com", 443, body));
+    server.wait();
+    CHECK(body == expected);
+    // Connected to the stand-in, but still asked for the real host
+    CHECK(server.serverName == "api.spotify.com");
+    CHECK(server.request.find("Host: api.spotify.com\r\n") != std::string::npos);
+    CHECK(!client.connected());
+}
+
+static void testVerified(SSL_CTX *tls, const char *caFile)
+{
+    StandInServer server(tls);
+    std::string expected;
+    server.serve(makeResponse(expected));
+
+    SpotifyPosixClient client;
+    client.setTimeout(2000);
+    client.setCACertFile(caFile);
+    client.redirect("127.0.0.1", server.port());
+    std::string body;
+    CHECK(fetch(client, "api.spotify.com", 443, body));
+    server.wait();
+    CHECK(body == expected);
+}
+
+static void testWrongHost(SSL_CTX *tls, const char *caFile)
+{
+    StandInServer server(tls);
+    server.serve("");
+
+    // Trusted certificate, but not for this name
+    SpotifyPosixClient client;
+    client.setTimeout(2000);
+    client.setCACertFile(caFile);
+    client.redirect("127.0.0.1", server.port());
+    CHECK(!client.connect("accounts.spotify.com", 443));
+    CHECK(!client.connected());
+    server.wait();
+    CHECK(!server.handshakeOk());
+}
+
+static void testUntrusted(SSL_CTX *tls)
+{
+    StandInServer server(tls);
+    server.serve("");
+
+    // Only the system CAs, which know nothing of the made up one
+    SpotifyPosixClient client;
+    client.setTimeout(2000);
+    client.redirect("127.0.0.1", server.port());
+    CHECK(!client.connect("api.spotify.com", 443));
+    server.wait();
+    CHECK(!server.handshakeOk());
+}
+
+static void testPlain()
+{
+    StandInServer server(NULL);
+    std::string expected;
+    server.serve(makeResponse(expected));
+
+    SpotifyPosixClient client(false);
+    client.setTimeout(2000);
+    client.redirect("127.0.0.1", server.port());
+    std::string body;
+    CHECK(fetch(client, "api.spotify.com", 80, body));
+    server.wait();
+    CHECK(body == expected);
+}
+
+static void testReadTimeout()
+{
+    StandInServer server(NULL);
+    server.serve("", true);
+
+    SpotifyPosixClient client(false);
+    client.setTimeout(200);
+    client.redirect("127.0.0.1", server.port());
+    CHECK(client.connect("api.spotify.com", 80));
+    client.print(F("GET / HTTP/1.1\r\n\r\n"));
+    unsigned long start = millis();
+    CHECK(client.read() == -1);
+    unsigned long waited = millis() - start;
+    CHECK(waited >= 150 && waited < 550);
+    client.stop();
+    server.wait();
+}
+
+static void testRefused()
+{
+    // Grab a free port and close it again, nothing is listening there
+    uint16_t port;
+    {
+        StandInServer server(NULL);
+        port = server.port();
+    }
+    SpotifyPosixClient client(false);
+    client.setTimeout(500);
+    client.redirect("127.0.0.1", port);
+    CHECK(!client.connect("api.spotify.com", 80));
+    CHECK(!client);
+}
+
+int main()
+{
+    TestCertificate certificate("api.spotify.com");
+    SSL_CTX *tls = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(tls, certificate.cert);
+    SSL_CTX_use_PrivateKey(tls, certificate.key);
+
+    testInsecureRedirect(tls);
+    testVerified(tls, certificate.path);
+    testWrongHost(tls, certificate.path);
+    testUntrusted(tls);
+    testPlain();
+    testReadTimeout();
+    testRefused();
+
+    SSL_CTX_free(tls);
+    printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// The host version of the replayBenchmark example: feeds every response
+// in its corpus to the call that made it through a SpotifyReplayClient,
+// and fails if any of them doesn't parse or doesn't fit. With
+// SPOTIFY_GZIP each one is sent a second time gzipped.
+
+#include <Arduino.h>
+#include "ArduinoSpotify.h"
+#include "ArduinoSpotifyReplay.h"
+#include "hostTest.h"
+
+// A few times over, so state left behind by one call that breaks the
+// next one shows up
+#define ITERATIONS 3
+
+char bearerToken[] = "replay";
+
+SpotifyReplayClient replay;
+ArduinoSpotify spotify(replay, bearerToken);
+
+// getAudioAnalysis() output goes nowhere
+class NullPrint : public Print
+{
+public:
+    size_t write(uint8_t) { return 1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+};
+NullPrint nullPrint;
+
+int searchResults = 0;
+void countResult(ArduinoSpotify &, const SpotifySearchResult &, uint8_t)
+{
+    searchResults++;
+}
+
+#ifdef SPOTIFY_GZIP
+// The same response with its body gzipped, and the headers to match
+static std::string gzipResponse(const std::string &response)
+{
+    size_t headersEnd = response.find("\r\n\r\n");
+    std::string body = gzip(response.substr(headersEnd + 4), 6);
+
+    std::string headers;
+    size_t start = 0;
+    while (start < headersEnd)
+    {
+        size_t end = response.find("\r\n", start);
+        std::string line = response.substr(start, end - start);
+        if (strncasecmp(line.c_str(), "Content-Length:", 15) != 0)
+        {
+            headers += line + "\r\n";
+        }
+        start = end + 2;
+    }
+    headers += "Content-Encoding: gzip\r\n";
+    headers += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    return headers + body;
+}
+#endif
+
+// Makes the call the file is named after, false if there isn't one
+static bool replayCall(const std::string &name)
+{
+    if (name.compare(0, 10, "currently_") == 0)
+    {
+        CurrentlyPlaying *playing = spotify.getCurrentlyPlaying();
+        CHECK(playing->trackName[0] != 0);
+    }
+    else if (name.compare(0, 7, "player_") == 0)
+    {
+        PlayerDetails *details = spotify.getPlayerDetails();
+        CHECK(details->device.id[0] != 0);
+    }
+    else if (name.compare(0, 8, "devices_") == 0)
+    {
+        SpotifyDevice *device = spotify.scanDevices();
+        CHECK(device != NULL);
+    }
+    else if (name.compare(0, 9, "features_") == 0)
+    {
+        spotify.getAudioFeatures("replay");
+    }
+    else if (name.compare(0, 9, "analysis_") == 0)
+    {
+        spotify.getAudioAnalysis("replay", &nullPrint);
+    }
+    else if (name.compare(0, 6, "state_") == 0)
+    {
+        spotify.getPlayerState();
+        CHECK(spotify.currentlyPlaying.trackName[0] != 0);
+    }
+    else if (name.compare(0, 7, "search_") == 0)
+    {
+        searchResults = 0;
+        spotify.search("replay", "track,album,artist", 10, countResult);
+        CHECK(searchResults > 0);
+    }
+#ifdef SPOTIFY_UP_NEXT
+    else if (name.compare(0, 6, "queue_") == 0)
+    {
+        spotify.getQueue();
+        CHECK(spotify.upNext.trackUri[0] != 0);
+    }
+#endif
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static void replayResponse(const std::string &name, const std::string &response, const char *encoding)
+{
+    spotify.resetDocumentPeak();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        BufferStream source(response);
+        replay.setResponse(&source);
+        int before = failures;
+        if (!replayCall(name))
+        {
+            printf("skip %s\n", name.c_str());
+            return;
+        }
+
+        // Every iteration has to work, not just the last one
+        const SpotifyResult &result = spotify.getLastResult();
+        bool overflowed = result.jsonError == DeserializationError::NoMemory ||
+                          spotify.getDocumentPeak() >= SPOTIFY_JSON_DOC_SIZE;
+        CHECK(result);
+        CHECK(!overflowed);
+        if (failures != before)
+        {
+            printf("FAIL %s%s iteration %d: phase %d, status %d, %s, doc %u/%u\n", name.c_str(), encoding, i,
+                   result.phase, result.httpStatus, result.jsonError.c_str(),
+                   (unsigned)spotify.getDocumentPeak(), (unsigned)SPOTIFY_JSON_DOC_SIZE);
+            return;
+        }
+    }
+    printf("ok   %s%s doc %u/%u\n", name.c_str(), encoding,
+           (unsigned)spotify.getDocumentPeak(), (unsigned)SPOTIFY_JSON_DOC_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: replayCorpus <corpus folder>\n");
+        return 2;
+    }
+
+    std::vector<std::string> names = listFolder(argv[1]);
+    if (names.empty())
+    {
+        printf("Nothing in %s\n", argv[1]);
+        return 2;
+    }
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        std::string response = readFile(std::string(argv[1]) + "/" + names[i]);
+        replayResponse(names[i], response, "");
+#ifdef SPOTIFY_GZIP
+        replayResponse(names[i], gzipResponse(response), " (gzip)");
+#endif
+    }
+
+    if (failures == 0)
+    {
+        printf("All passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
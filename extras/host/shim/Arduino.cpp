@@ -0,0 +1,199 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "Arduino.h"
+
+#include <time.h>
+#include <unistd.h>
+
+HostSerial Serial;
+
+static unsigned long long monotonicUs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(monotonicUs() / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)monotonicUs();
+}
+
+void delay(unsigned long ms)
+{
+    usleep(ms * 1000);
+}
+
+void yield()
+{
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+    {
+        if (write(*buffer++) == 0)
+        {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+size_t Print::print(long n, int base)
+{
+    if (base != 10)
+    {
+        return print((unsigned long)n, base);
+    }
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%ld", n);
+    return write(buffer);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), (base == 16) ? "%lX" : (base == 8) ? "%lo" : "%lu", n);
+    return write(buffer);
+}
+
+size_t Print::print(double n, int digits)
+{
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+    return write(buffer);
+}
+
+int Stream::timedRead()
+{
+    unsigned long start = millis();
+    do
+    {
+        int c = read();
+        if (c >= 0)
+        {
+            return c;
+        }
+        usleep(100);
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+int Stream::timedPeek()
+{
+    unsigned long start = millis();
+    do
+    {
+        int c = peek();
+        if (c >= 0)
+        {
+            return c;
+        }
+        usleep(100);
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+bool Stream::find(const char *target)
+{
+    size_t length = strlen(target);
+    size_t matched = 0;
+    if (length == 0)
+    {
+        return true;
+    }
+    int c;
+    while ((c = timedRead()) >= 0)
+    {
+        if (c == target[matched])
+        {
+            if (++matched == length)
+            {
+                return true;
+            }
+        }
+        else
+        {
+            matched = (c == target[0]) ? 1 : 0;
+        }
+    }
+    return false;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+    {
+        int c = timedRead();
+        if (c < 0)
+        {
+            break;
+        }
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+    {
+        int c = timedRead();
+        if (c < 0 || c == terminator)
+        {
+            break;
+        }
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+long Stream::parseInt()
+{
+    int c;
+    while ((c = timedPeek()) >= 0 && !isdigit(c) && c != '-')
+    {
+        read();
+    }
+    bool negative = false;
+    if (c == '-')
+    {
+        negative = true;
+        read();
+    }
+    long value = 0;
+    while ((c = timedPeek()) >= 0 && isdigit(c))
+    {
+        value = value * 10 + (c - '0');
+        read();
+    }
+    return negative ? -value : value;
+}
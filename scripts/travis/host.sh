@@ -0,0 +1,11 @@
+#!/bin/sh -eux
+
+mkdir -p build-host
+cd build-host
+# The replay tests build the whole library, which needs ArduinoJson 6
+if [ ! -d ArduinoJson ]; then
+    git clone --depth 1 --branch v6.21.5 https://github.com/bblanchon/ArduinoJson.git ArduinoJson
+fi
+cmake ../extras/host -DARDUINOJSON_DIR=$PWD/ArduinoJson
+cmake --build .
+ctest --output-on-failure
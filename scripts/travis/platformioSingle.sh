@@ -1,3 +1,9 @@
 #!/bin/sh -eux
 
-platformio ci $PWD/examples/$BOARDTYPE$EXAMPLE_FOLDER$EXAMPLE_NAME/$EXAMPLE_NAME.ino -l '.' -b $BOARD
+# BUILD_FLAGS is for examples that need a library option defined, e.g.
+# -DSPOTIFY_DEVICE_LIST. It has to reach the library, not just the sketch.
+if [ -n "${BUILD_FLAGS:-}" ]; then
+    platformio ci $PWD/examples/$BOARDTYPE$EXAMPLE_FOLDER$EXAMPLE_NAME/$EXAMPLE_NAME.ino -l '.' -b $BOARD --project-option="build_flags=$BUILD_FLAGS"
+else
+    platformio ci $PWD/examples/$BOARDTYPE$EXAMPLE_FOLDER$EXAMPLE_NAME/$EXAMPLE_NAME.ino -l '.' -b $BOARD
+fi
@@ -20,88 +20,234 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "ArduinoSpotify.h"
 
-ArduinoSpotify::ArduinoSpotify(Client &client)
+// What the sketch's SpotifyLayoutCheck needs to link
+template <>
+const char SPOTIFY_LAYOUT::matched = 1;
+
+#ifdef SPOTIFY_MAX_OBJECT_SIZE
+static_assert(sizeof(ArduinoSpotify) <= SPOTIFY_MAX_OBJECT_SIZE,
+              "ArduinoSpotify is bigger than SPOTIFY_MAX_OBJECT_SIZE, shrink the capacities in ArduinoSpotify.h");
+#endif
+
+#ifdef SPOTIFY_REPORT_FOOTPRINT
+// There is no portable way to print a sizeof at build time, but the
+// compiler does list the template arguments when it warns inside an
+// instantiation, so the sizes show up in the build output like:
+//   [with unsigned int ObjectBytes = 3312; unsigned int JsonDocBytes = 2000; ...]
+__attribute__((deprecated("ArduinoSpotify footprint report, the sizes are in the template arguments")))
+static inline void spotifyFootprintReport() {}
+
+template <size_t ObjectBytes, size_t JsonDocBytes, size_t CurrentlyPlayingBytes, size_t PlayerDetailsBytes>
+struct SpotifyFootprint
 {
-    this->client = &client;
-	memset(this->_clientId, 0, 33*sizeof(char));
-	memset(this->_clientSecret, 0, 33*sizeof(char));
+    static void report() { spotifyFootprintReport(); }
+};
+
+template struct SpotifyFootprint<sizeof(ArduinoSpotify), SPOTIFY_JSON_DOC_SIZE, sizeof(CurrentlyPlaying), sizeof(PlayerDetails)>;
+#endif
 
-    _initCurrentlyPlayingStruct();
+#ifdef SPOTIFY_STATS
+#define SPOTIFY_STAT(call) this->_stats.call
+
+// Works out which endpoint a request is for, only used for the stats
+static uint8_t statsEndpointId(const char *host, const char *command)
+{
+    if (strcmp(host, SPOTIFY_ACCOUNTS_HOST) == 0)
+    {
+        return spotify_endpoint_token;
+    }
+    if (strcmp(host, SPOTIFY_HOST) != 0)
+    {
+        return spotify_endpoint_image;
+    }
+
+    size_t playerLength = strlen(SPOTIFY_PLAYER_ENDPOINT);
+    if (strncmp(command, SPOTIFY_CURRENTLY_PLAYING_ENDPOINT, strlen(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT)) == 0)
+    {
+        return spotify_endpoint_currently_playing;
+    }
+    if (strncmp(command, SPOTIFY_DEVICES_ENDPOINT, strlen(SPOTIFY_DEVICES_ENDPOINT)) == 0)
+    {
+        return spotify_endpoint_devices;
+    }
+    if (strncmp(command, SPOTIFY_PLAYER_ENDPOINT, playerLength) == 0)
+    {
+        char next = command[playerLength];
+        return (next == 0 || next == '?') ? spotify_endpoint_player : spotify_endpoint_player_control;
+    }
+    return spotify_endpoint_other;
 }
 
-ArduinoSpotify::ArduinoSpotify(Client &client, char *bearerToken)
+// Passes reads through to the client, counting the bytes on the way
+class SpotifyCountingStream : public Stream
 {
-    this->client = &client;
-	memset(this->_bearerToken, 0, SIZEOFACCESS*sizeof(char));
-    strncpy(this->_bearerToken, "Bearer ", 7);
-	strncat(this->_bearerToken, bearerToken, (SIZEOFACCESS-1-7));
+public:
+    SpotifyCountingStream(Stream &stream) : _stream(stream), count(0)
+    {
+        setTimeout(SPOTIFY_TIMEOUT);
+    }
+    int available() { return _stream.available(); }
+    int read()
+    {
+        int c = _stream.read();
+        if (c >= 0)
+        {
+            count++;
+        }
+        return c;
+    }
+    int peek() { return _stream.peek(); }
+    size_t write(uint8_t c) { return _stream.write(c); }
+
+private:
+    Stream &_stream;
+
+public:
+    size_t count;
+};
+#else
+#define SPOTIFY_STAT(call)
+#endif
 
-    _initCurrentlyPlayingStruct();
+ArduinoSpotify::ArduinoSpotify(Client &client, SpotifyLayoutCheck)
+{
+    this->client = &client;
+    _initSessions();
+    _initActions();
+    _rangeStart = -1;
+    _acceptGzip = false;
+#ifdef SPOTIFY_DEVICE_LIST
+    _deviceCount = 0;
+    _devicesValid = false;
+#endif
+    _docPeak = 0;
+    setupSession(_defaultSession, "", "", "");
+
+    _initCurrentlyPlayingStruct(this->currentlyPlaying);
+    _currentlyPlayingAt = 0;
+#ifdef SPOTIFY_UP_NEXT
+    _initCurrentlyPlayingStruct(this->upNext);
+    _prefetchedFor = 0;
+#endif
+    resetResult();
+    onChange(NULL);
 }
 
-ArduinoSpotify::ArduinoSpotify(Client &client, const char *clientId, const char *clientSecret, const char *refreshToken)
+ArduinoSpotify::ArduinoSpotify(Client &client, char *bearerToken, SpotifyLayoutCheck)
 {
     this->client = &client;
-	memset(this->_clientId, 0, 33*sizeof(char));
-    strncpy(this->_clientId, clientId, 32);
-	memset(this->_clientSecret, 0, 33*sizeof(char));
-    strncpy(this->_clientSecret, clientSecret, 32);
-	memset(this->_refreshToken, 0, SIZEOFREFRES*sizeof(char));
-    strncpy(this->_refreshToken, refreshToken, (SIZEOFREFRES-1));
+    _initSessions();
+    _initActions();
+    _rangeStart = -1;
+    _acceptGzip = false;
+#ifdef SPOTIFY_DEVICE_LIST
+    _deviceCount = 0;
+    _devicesValid = false;
+#endif
+    _docPeak = 0;
+    setupSession(_defaultSession, "", "", "");
+    strncpy(_session->bearerToken, "Bearer ", 7);
+	strncat(_session->bearerToken, bearerToken, (SIZEOFACCESS-1-7));
+
+    _initCurrentlyPlayingStruct(this->currentlyPlaying);
+    _currentlyPlayingAt = 0;
+#ifdef SPOTIFY_UP_NEXT
+    _initCurrentlyPlayingStruct(this->upNext);
+    _prefetchedFor = 0;
+#endif
+    resetResult();
+    onChange(NULL);
+}
 
-    _initCurrentlyPlayingStruct();
+ArduinoSpotify::ArduinoSpotify(Client &client, const char *clientId, const char *clientSecret, const char *refreshToken, SpotifyLayoutCheck)
+{
+    this->client = &client;
+    _initSessions();
+    _initActions();
+    _rangeStart = -1;
+    _acceptGzip = false;
+#ifdef SPOTIFY_DEVICE_LIST
+    _deviceCount = 0;
+    _devicesValid = false;
+#endif
+    _docPeak = 0;
+    setupSession(_defaultSession, clientId, clientSecret, refreshToken);
+
+    _initCurrentlyPlayingStruct(this->currentlyPlaying);
+    _currentlyPlayingAt = 0;
+#ifdef SPOTIFY_UP_NEXT
+    _initCurrentlyPlayingStruct(this->upNext);
+    _prefetchedFor = 0;
+#endif
+    resetResult();
+    onChange(NULL);
 }
 
 int ArduinoSpotify::makeRequestWithBody(const char *type, const char *command, const char *authorization, const char *body, const char *contentType, const char *host)
 {
 
     int status = 0;
+    resetResult();
     client->flush();
     client->setTimeout(SPOTIFY_TIMEOUT);
+    SPOTIFY_STAT(begin(statsEndpointId(host, command)));
     status = client->connect(host, portNumber);
     if (!status)
     {
+#ifdef SPOTIFY_DEBUG
         Serial.print("makeRequestWithBody: ");
         Serial.println(status);
+#endif
+        setResultError(spotify_error_connect);
+        SPOTIFY_STAT(end(false));
         return status;
     }
+    SPOTIFY_STAT(mark(spotify_phase_connect));
 
     // give the esp a breather
     yield();
 
     // Send HTTP request
-    client->print(type);
-    client->print(command);
-    client->println(F(" HTTP/1.1"));
+    size_t sent = 0;
+    sent += client->print(type);
+    sent += client->print(command);
+    sent += client->println(F(" HTTP/1.1"));
 
     //Headers
-    client->print(F("Host: "));
-    client->println(host);
+    sent += client->print(F("Host: "));
+    sent += client->println(host);
 
-    client->println(F("Accept: application/json"));
-    client->print(F("Content-Type: "));
-    client->println(contentType);
+    sent += client->println(F("Accept: application/json"));
+    sent += client->print(F("Content-Type: "));
+    sent += client->println(contentType);
 
     if (authorization != NULL)
     {
-        client->print(F("Authorization: "));
-        client->println(authorization);
+        sent += client->print(F("Authorization: "));
+        sent += client->println(authorization);
     }
 
-    client->println(F("Cache-Control: no-cache"));
+    sent += client->println(F("Cache-Control: no-cache"));
 
-    client->print(F("Content-Length: "));
-    client->println(strlen(body));
+    sent += client->print(F("Content-Length: "));
+    sent += client->println(strlen(body));
 
-    client->println();
+    sent += client->println();
 
-    client->print(body);
+    sent += client->print(body);
 
-    if (client->println() == 0)
+    size_t lastLine = client->println();
+    SPOTIFY_STAT(addSent(sent + lastLine));
+    (void)sent;
+    if (lastLine == 0)
     {
+#ifdef SPOTIFY_DEBUG
         Serial.println(F("Failed to send request"));
+#endif
+        setResultError(spotify_error_send);
         return -2;
     }
+    SPOTIFY_STAT(mark(spotify_phase_send));
 
     int statusCode = getHttpStatusCode();
     return statusCode;
@@ -119,45 +265,76 @@ int ArduinoSpotify::makePostRequest(const char *command, const char *authorizati
 
 int ArduinoSpotify::makeGetRequest(const char *command, const char *authorization, const char *accept, const char *host)
 {
+    // Only ever for this request, whichever way it ends
+    bool acceptGzip = _acceptGzip;
+    _acceptGzip = false;
+
+    resetResult();
     client->flush();
     client->setTimeout(SPOTIFY_TIMEOUT);
+    SPOTIFY_STAT(begin(statsEndpointId(host, command)));
     if (!client->connect(host, portNumber))
     {
+#ifdef SPOTIFY_DEBUG
         Serial.println(F("makeGetRequest: Connection failed"));
+#endif
+        setResultError(spotify_error_connect);
+        SPOTIFY_STAT(end(false));
         return -1;
     }
+    SPOTIFY_STAT(mark(spotify_phase_connect));
 
     // give the esp a breather
     yield();
 
     // Send HTTP request
-    client->print(F("GET "));
-    client->print(command);
-    client->println(F(" HTTP/1.1"));
+    size_t sent = 0;
+    sent += client->print(F("GET "));
+    sent += client->print(command);
+    sent += client->println(F(" HTTP/1.1"));
 
     //Headers
-    client->print(F("Host: "));
-    client->println(host);
+    sent += client->print(F("Host: "));
+    sent += client->println(host);
 
     if (accept != NULL)
     {
-        client->print(F("Accept: "));
-        client->println(accept);
+        sent += client->print(F("Accept: "));
+        sent += client->println(accept);
     }
 
     if (authorization != NULL)
     {
-        client->print(F("Authorization: "));
-        client->println(authorization);
+        sent += client->print(F("Authorization: "));
+        sent += client->println(authorization);
+    }
+
+    sent += client->println(F("Cache-Control: no-cache"));
+
+    if (_rangeStart >= 0)
+    {
+        sent += client->print(F("Range: bytes="));
+        sent += client->print(_rangeStart);
+        sent += client->println(F("-"));
     }
 
-    client->println(F("Cache-Control: no-cache"));
+    if (acceptGzip)
+    {
+        sent += client->println(F("Accept-Encoding: gzip"));
+    }
 
-    if (client->println() == 0)
+    size_t lastLine = client->println();
+    SPOTIFY_STAT(addSent(sent + lastLine));
+    (void)sent;
+    if (lastLine == 0)
     {
+#ifdef SPOTIFY_DEBUG
         Serial.println(F("Failed to send request"));
+#endif
+        setResultError(spotify_error_send);
         return -2;
     }
+    SPOTIFY_STAT(mark(spotify_phase_send));
     int statusCode = getHttpStatusCode();
 
     return statusCode;
@@ -165,27 +342,27 @@ int ArduinoSpotify::makeGetRequest(const char *command, const char *authorizatio
 
 void ArduinoSpotify::setClientId(const char *clientId)
 {
-	memset(this->_clientId, 0, 33*sizeof(char));
-    strncpy(this->_clientId, clientId, 32);
+	memset(_session->clientId, 0, 33*sizeof(char));
+    strncpy(_session->clientId, clientId, 32);
 }
 
 void ArduinoSpotify::setClientSecret(const char *clientSecret)
 {
-	memset(this->_clientSecret, 0, 33*sizeof(char));
-    strncpy(this->_clientSecret, clientSecret, 32);
+	memset(_session->clientSecret, 0, 33*sizeof(char));
+    strncpy(_session->clientSecret, clientSecret, 32);
 }
 
 void ArduinoSpotify::setRefreshToken(const char *refreshToken)
 {
-	memset(this->_refreshToken, 0, SIZEOFREFRES*sizeof(char));
-    strncpy(this->_refreshToken, refreshToken, (SIZEOFREFRES-1));
+	memset(_session->refreshToken, 0, SIZEOFREFRES*sizeof(char));
+    strncpy(_session->refreshToken, refreshToken, (SIZEOFREFRES-1));
 }
 
-bool ArduinoSpotify::refreshAccessToken()
+const SpotifyResult &ArduinoSpotify::refreshAccessToken()
 {
     char body[310];
 	memset(body, 0, 310*sizeof(char));
-    sprintf(body, this->refreshAccessTokensBody, this->_refreshToken, this->_clientId, this->_clientSecret);
+    sprintf(body, this->refreshAccessTokensBody, _session->refreshToken, _session->clientId, _session->clientSecret);
 
 #ifdef SPOTIFY_DEBUG
 	Serial.println("In refreshAccessToken");
@@ -193,9 +370,10 @@ bool ArduinoSpotify::refreshAccessToken()
 #endif
 
     int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
+    bool gotHeaders = false;
     if (statusCode > 0)
     {
-        skipHeaders();
+        gotHeaders = skipHeaders();
     }
     unsigned long now = millis();
 
@@ -204,38 +382,48 @@ bool ArduinoSpotify::refreshAccessToken()
     Serial.println(statusCode);
 #endif
 
-    bool refreshed = false;
-    if (statusCode == 200)
+    if (statusCode == 200 && gotHeaders)
     {
         //DynamicJsonDocument doc(1000);
-        DeserializationError error = deserializeJson(doc, *client);
+        DeserializationError error = deserializeResponse();
         if (!error)
         {
-			memset(this->_bearerToken, 0, SIZEOFACCESS*sizeof(char));
-            strncpy(this->_bearerToken, "Bearer ", 7);
-            strncat(this->_bearerToken, (char *)doc["access_token"].as<const char *>(), (SIZEOFACCESS-1-7)  );
+			memset(_session->bearerToken, 0, SIZEOFACCESS*sizeof(char));
+            strncpy(_session->bearerToken, "Bearer ", 7);
+            strncat(_session->bearerToken, (char *)doc["access_token"].as<const char *>(), (SIZEOFACCESS-1-7)  );
             int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-			tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-            timeTokenRefreshed = now;
-            refreshed = true;
+			_session->tokenTimeToLiveMs = (tokenTtl * 1000L) - 2000; // The 2000 is just to force the token expiry to check if its very close
+            _session->timeTokenRefreshed = now;
+        }
+        else
+        {
+            setParseError(error);
         }
 	doc.clear();
     }
-    else
+    else if (gotHeaders)
     {
         parseError();
     }
 
     closeClient();
-    return refreshed;
+    return _lastResult;
 }
 
 bool ArduinoSpotify::checkAndRefreshAccessToken()
 {
-    unsigned long timeSinceLastRefresh = millis() - timeTokenRefreshed;
-    if (timeSinceLastRefresh >= tokenTimeToLiveMs)
+    if (_session->refreshToken[0] == 0)
+    {
+        // Nothing to refresh with, e.g. created with just a bearer token
+        return true;
+    }
+
+    unsigned long timeSinceLastRefresh = millis() - _session->timeTokenRefreshed;
+    if (timeSinceLastRefresh >= _session->tokenTimeToLiveMs)
     {
+#ifdef SPOTIFY_DEBUG
         Serial.println("Refresh of the Access token is due, doing that now.");
+#endif
         return refreshAccessToken();
     }
 
@@ -245,19 +433,19 @@ bool ArduinoSpotify::checkAndRefreshAccessToken()
 
 const char *ArduinoSpotify::getAccessToken()
 {
-	return (7*sizeof(char))+this->_bearerToken;
+	return (7*sizeof(char))+_session->bearerToken;
 }
 
 const char *ArduinoSpotify::getRefreshToken()
 {
-	return this->_refreshToken;
+	return _session->refreshToken;
 }
 
 const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *redirectUrl)
 {
     char body[560];
 	memset(body, 0, 560*sizeof(char));
-    sprintf(body, requestAccessTokensBody, redirectUrl, code, this->_clientId, this->_clientSecret);
+    sprintf(body, requestAccessTokensBody, redirectUrl, code, _session->clientId, _session->clientSecret);
 
 #ifdef SPOTIFY_DEBUG
 	Serial.println("In requestAccessTokens");
@@ -265,9 +453,10 @@ const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *re
 #endif
 
     int statusCode = makePostRequest(SPOTIFY_TOKEN_ENDPOINT, NULL, body, "application/x-www-form-urlencoded", SPOTIFY_ACCOUNTS_HOST);
+    bool gotHeaders = false;
     if (statusCode > 0)
     {
-        skipHeaders();
+        gotHeaders = skipHeaders();
     }
     unsigned long now = millis();
 
@@ -276,369 +465,532 @@ const char *ArduinoSpotify::requestAccessTokens(const char *code, const char *re
     Serial.println(statusCode);
 #endif
 
-    if (statusCode == 200)
+    if (statusCode == 200 && gotHeaders)
     {
         //DynamicJsonDocument doc(1000);
-        DeserializationError error = deserializeJson(doc, *client);
+        DeserializationError error = deserializeResponse();
         if (!error)
         {
-			memset(this->_bearerToken, 0, SIZEOFACCESS*sizeof(char));
-            strncpy(this->_bearerToken, "Bearer ", 7);
-			strncat(this->_bearerToken, (char *)doc["access_token"].as<const char *>(), (SIZEOFACCESS-1-7));
-	        memset(this->_refreshToken, 0, SIZEOFREFRES*sizeof(char));
-            strncpy(this->_refreshToken, (char *)doc["refresh_token"].as<const char *>(), (SIZEOFREFRES-1));
+			memset(_session->bearerToken, 0, SIZEOFACCESS*sizeof(char));
+            strncpy(_session->bearerToken, "Bearer ", 7);
+			strncat(_session->bearerToken, (char *)doc["access_token"].as<const char *>(), (SIZEOFACCESS-1-7));
+	        memset(_session->refreshToken, 0, SIZEOFREFRES*sizeof(char));
+            strncpy(_session->refreshToken, (char *)doc["refresh_token"].as<const char *>(), (SIZEOFREFRES-1));
             int tokenTtl = doc["expires_in"];             // Usually 3600 (1 hour)
-            tokenTimeToLiveMs = (tokenTtl * 1000) - 2000; // The 2000 is just to force the token expiry to check if its very close
-            timeTokenRefreshed = now;
+            _session->tokenTimeToLiveMs = (tokenTtl * 1000L) - 2000; // The 2000 is just to force the token expiry to check if its very close
+            _session->timeTokenRefreshed = now;
+        }
+        else
+        {
+            setParseError(error);
         }
 	doc.clear();
     }
-    else
+    else if (gotHeaders)
     {
         parseError();
     }
 
     closeClient();
-    return this->_refreshToken;
+    return _session->refreshToken;
 }
 
-bool ArduinoSpotify::play(const char *deviceId)
+const SpotifyResult &ArduinoSpotify::play(const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_PLAY_ENDPOINT, 124);
-    return playerControl(command, deviceId);
+    command.setPath(SPOTIFY_PLAY_ENDPOINT);
+    return playerControl(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::playAdvanced(char *body, const char *deviceId)
+const SpotifyResult &ArduinoSpotify::playAdvanced(char *body, const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_PLAY_ENDPOINT, 124);
-    return playerControl(command, deviceId, body);
+    command.setPath(SPOTIFY_PLAY_ENDPOINT);
+    return playerControl(command.c_str(), deviceId, body);
 }
 
-bool ArduinoSpotify::pause(const char *deviceId)
+const SpotifyResult &ArduinoSpotify::pause(const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_PAUSE_ENDPOINT, 124);
-    return playerControl(command, deviceId);
+    command.setPath(SPOTIFY_PAUSE_ENDPOINT);
+    return playerControl(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::setVolume(int volume, const char *deviceId)
+const SpotifyResult &ArduinoSpotify::setVolume(int volume, const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    sprintf(command, SPOTIFY_VOLUME_ENDPOINT, volume);
-    return playerControl(command, deviceId);
+    command.setPath(SPOTIFY_VOLUME_ENDPOINT);
+    command.addParam("volume_percent", volume);
+    return playerControl(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::toggleShuffle(bool shuffle, const char *deviceId)
+const SpotifyResult &ArduinoSpotify::toggleShuffle(bool shuffle, const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    char shuffleState[6];
-    memset(shuffleState, 0, 6*sizeof(char));
-    if (shuffle)
-    {
-        strncpy(shuffleState, "true", 5);
-    }
-    else
-    {
-        strncpy(shuffleState, "false", 5);
-    }
-    sprintf(command, SPOTIFY_SHUFFLE_ENDPOINT, shuffleState);
-    return playerControl(command, deviceId);
+    command.setPath(SPOTIFY_SHUFFLE_ENDPOINT);
+    command.addParam("state", shuffle ? "true" : "false");
+    return playerControl(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::setRepeatMode(RepeatOptions repeat, const char *deviceId)
+const SpotifyResult &ArduinoSpotify::setRepeatMode(RepeatOptions repeat, const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    char repeatState[8];
-	memset(repeatState, 0, 8*sizeof(char));
+    const char *repeatState = "off";
     switch (repeat)
     {
     case repeat_track:
-        strncpy(repeatState, "track", 5);
+        repeatState = "track";
         break;
     case repeat_context:
-        strncpy(repeatState, "context", 7);
+        repeatState = "context";
         break;
     case repeat_off:
-        strncpy(repeatState, "off", 3);
+        repeatState = "off";
         break;
     }
 
-    sprintf(command, SPOTIFY_REPEAT_ENDPOINT, repeatState);
-    return playerControl(command, deviceId);
+    command.setPath(SPOTIFY_REPEAT_ENDPOINT);
+    command.addParam("state", repeatState);
+    return playerControl(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::playerControl(char *command, const char *deviceId, const char *body)
+const SpotifyResult &ArduinoSpotify::playerControl(const char *command, const char *deviceId, const char *body)
 {
-    if (deviceId[0] != 0)
+    // Sketches can still pass in their own path, the built in
+    // methods have already composed it in place.
+    if (command != this->command.c_str())
     {
-        char *questionMarkPointer;
-        questionMarkPointer = strchr(command, '?');
-        char deviceIdBuff[50];
-		memset(deviceIdBuff, 0, 50*sizeof(char));
-        if (questionMarkPointer == NULL)
-        {
-            sprintf(deviceIdBuff, "?deviceId=%s", deviceId);
-        }
-        else
-        {
-            // params already started
-            sprintf(deviceIdBuff, "&deviceId=%s", deviceId);
-        }
-        strcat(command, deviceIdBuff);
+        this->command.setPath(command);
     }
 
 #ifdef SPOTIFY_DEBUG
-    Serial.println(command);
     Serial.println(body);
 #endif
 
-    if (autoTokenRefresh)
+    sendControl("PUT ", deviceId, body);
+    return _lastResult;
+}
+
+const SpotifyResult &ArduinoSpotify::playerNavigate(const char *command, const char *deviceId)
+{
+    if (command != this->command.c_str())
     {
-        checkAndRefreshAccessToken();
+        this->command.setPath(command);
     }
-    int statusCode = makePutRequest(command, this->_bearerToken, body);
 
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+    sendControl("POST ", deviceId);
+    return _lastResult;
 }
 
-bool ArduinoSpotify::playerNavigate(char *command, const char *deviceId)
+#ifdef SPOTIFY_DEVICE_LIST
+// Spotify's device ids are 40 hex digits, anything else is a name or type
+static bool isDeviceId(const char *deviceId)
 {
-    if (deviceId[0] != 0)
+    size_t length = 0;
+    for (; deviceId[length] != 0; length++)
     {
-        char deviceIdBuff[50];
-		memset(deviceIdBuff, 0, 50*sizeof(char));
-        sprintf(deviceIdBuff, "?deviceId=%s", deviceId);
-        strcat(command, deviceIdBuff);
+        if (!isxdigit((unsigned char)deviceId[length]))
+        {
+            return false;
+        }
     }
+    return length == 40;
+}
+#endif
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
+// Sends the control composed in command with the device_id added. Names
+// are resolved from the device list (SPOTIFY_DEVICE_LIST), which is only
+// fetched on a miss or when the id we had for the name gets a 404.
+// Without it deviceId has to be an id.
+void ArduinoSpotify::sendControl(const char *type, const char *deviceId, const char *body)
+{
+#ifdef SPOTIFY_DEVICE_LIST
+    bool byName = deviceId[0] != 0 && !isDeviceId(deviceId) && !command.truncated();
+#else
+    bool byName = false;
 #endif
+    if (!byName)
+    {
+        if (deviceId[0] != 0)
+        {
+            command.addParam("device_id", deviceId);
+        }
+        sendApiRequest(type, body);
+        closeClient();
+        return;
+    }
 
-    if (autoTokenRefresh)
+#ifdef SPOTIFY_DEVICE_LIST
+    // Fetching the devices reuses command, and the name could point into
+    // the device list
+    char path[SPOTIFY_COMMAND_SIZE];
+    strcpy(path, command.c_str());
+    char name[sizeof(_devices[0].name)];
+    strncpy(name, deviceId, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+
+    bool refreshed = false;
+    while (true)
     {
-        checkAndRefreshAccessToken();
+        const SpotifyDevice *device = _lookupDevice(name);
+        if (device == NULL && !refreshed)
+        {
+            refreshed = true;
+            if (!_refreshDevices())
+            {
+                // The result says why
+                return;
+            }
+            device = _lookupDevice(name);
+        }
+        if (device == NULL)
+        {
+#ifdef SPOTIFY_DEBUG
+            Serial.print(F("No device called: "));
+            Serial.println(name);
+#endif
+            resetResult();
+            setResultError(spotify_error_request);
+            strncpy(_lastResult.message, "Device not found", SPOTIFY_ERROR_MESSAGE_SIZE - 1);
+            _lastResult.message[SPOTIFY_ERROR_MESSAGE_SIZE - 1] = 0;
+            return;
+        }
+
+        command.setPath(path);
+        command.addParam("device_id", device->id);
+        sendApiRequest(type, body);
+        closeClient();
+
+        // The device may have come back with a new id, but if the list
+        // was just fetched there is nothing newer to try
+        if (_lastResult.httpStatus != 404 || refreshed)
+        {
+            return;
+        }
+        invalidateDevices();
     }
-    int statusCode = makePostRequest(command, this->_bearerToken);
+#endif
+}
 
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+const SpotifyResult &ArduinoSpotify::nextTrack(const char *deviceId)
+{
+    command.setPath(SPOTIFY_NEXT_TRACK_ENDPOINT);
+    return playerNavigate(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::nextTrack(const char *deviceId)
+const SpotifyResult &ArduinoSpotify::previousTrack(const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_NEXT_TRACK_ENDPOINT, 124);
-    return playerNavigate(command, deviceId);
+    command.setPath(SPOTIFY_PREVIOUS_TRACK_ENDPOINT);
+    return playerNavigate(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::previousTrack(const char *deviceId)
+const SpotifyResult &ArduinoSpotify::seek(int position, const char *deviceId)
 {
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_PREVIOUS_TRACK_ENDPOINT, 124);
-    return playerNavigate(command, deviceId);
+    command.setPath(SPOTIFY_SEEK_ENDPOINT);
+    command.addParam("position_ms", position);
+    // playerControl takes care of appending the device
+    return playerControl(command.c_str(), deviceId);
 }
 
-bool ArduinoSpotify::seek(int position, const char *deviceId)
+// Copies a string from the JSON, missing or null values (ads, local
+// files, episodes) come out as an empty string
+static void copyJsonString(char *dest, const char *value, size_t size)
 {
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_SEEK_ENDPOINT, 124);
-    char tempBuff[50];
-    memset(tempBuff, 0, 50*sizeof(char));
-    sprintf(tempBuff, "?position_ms=%d", position);
-    strncat(command, tempBuff, 50);
-    if (deviceId[0] != 0)
+    if (value == NULL)
     {
-        sprintf(tempBuff, "?deviceId=%s", deviceId);
-        strcat(command, tempBuff);
+        dest[0] = 0;
+        return;
     }
+    strncpy(dest, value, size - 1);
+    dest[size - 1] = 0;
+}
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
+// Only keep what goes in the struct, episode descriptions and the list
+// of markets would otherwise fill the doc
+static void addCurrentlyPlayingFilter(JsonObject filter)
+{
+    filter["is_playing"] = true;
+    filter["progress_ms"] = true;
+    filter["currently_playing_type"] = true;
+    JsonObject itemFilter = filter.createNestedObject("item");
+    itemFilter["name"] = true;
+    itemFilter["uri"] = true;
+    itemFilter["duration_ms"] = true;
+    itemFilter["images"][0]["url"] = true;
+    JsonObject albumFilter = itemFilter.createNestedObject("album");
+    albumFilter["name"] = true;
+    albumFilter["uri"] = true;
+    albumFilter["artists"][0]["name"] = true;
+    albumFilter["artists"][0]["uri"] = true;
+    albumFilter["images"][0]["url"] = true;
+    JsonObject showFilter = itemFilter.createNestedObject("show");
+    showFilter["name"] = true;
+    showFilter["uri"] = true;
+    showFilter["publisher"] = true;
+    showFilter["images"][0]["url"] = true;
+}
 
-    if (autoTokenRefresh)
-    {
-        checkAndRefreshAccessToken();
-    }
-    int statusCode = makePutRequest(command, this->_bearerToken);
-    closeClient();
-    //Will return 204 if all went well.
-    return statusCode == 204;
+static void addPlayerDetailsFilter(JsonObject filter)
+{
+    JsonObject deviceFilter = filter.createNestedObject("device");
+    deviceFilter["id"] = true;
+    deviceFilter["name"] = true;
+    deviceFilter["type"] = true;
+    deviceFilter["is_active"] = true;
+    deviceFilter["is_private_session"] = true;
+    deviceFilter["is_restricted"] = true;
+    deviceFilter["volume_percent"] = true;
+    filter["progress_ms"] = true;
+    filter["is_playing"] = true;
+    filter["shuffle_state"] = true;
+    filter["repeat_state"] = true;
 }
 
 CurrentlyPlaying* ArduinoSpotify::getCurrentlyPlaying(const char *market)
 {
-	_initCurrentlyPlayingStruct();
+    // Controls the user is waiting on go before background polls
+    runQueuedActions();
+	_initCurrentlyPlayingStruct(this->currentlyPlaying);
 
-    memset(command, 0, 125*sizeof(char));
-    strncpy(command, SPOTIFY_CURRENTLY_PLAYING_ENDPOINT, 124);
+    command.setPath(SPOTIFY_CURRENTLY_PLAYING_ENDPOINT);
     if (market[0] != 0)
     {
-        char marketBuff[30];
-		memset(marketBuff, 0, 30*sizeof(char));
-        sprintf(marketBuff, "?market=%s", market);
-        strncat(command, marketBuff, (100-1-10));
+        command.addParam("market", market);
     }
+    // Without this podcasts come back with a null item
+    command.addParam("additional_types", "episode");
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-
-    // Get from https://arduinojson.org/v6/assistant/
-    //const size_t bufferSize = currentlyPlayingBufferSize;
     // This flag will get cleared if all goes well
     this->currentlyPlaying.error = true;
-    if (autoTokenRefresh)
-    {
-        checkAndRefreshAccessToken();
-    }
-
-    int statusCode = makeGetRequest(command, this->_bearerToken);
-    if (statusCode > 0)
-    {
-        skipHeaders();
-    }
 
+    int statusCode = sendApiRequest(NULL);
     if (statusCode == 200)
     {
-        // Allocate DynamicJsonDocument
-        //DynamicJsonDocument doc(bufferSize);
+        StaticJsonDocument<512> filter;
+        addCurrentlyPlayingFilter(filter.to<JsonObject>());
 
         // Parse JSON object
-        DeserializationError error = deserializeJson(doc, *client);
+        DeserializationError error = deserializeResponse(&filter);
         if (!error)
         {
-            JsonObject item = doc["item"];
-            JsonObject firstArtist = item["album"]["artists"][0];
-            
-			strncpy(this->currentlyPlaying.firstArtistName, (char *)firstArtist["name"].as<const char *>(), 63);
-            strncpy(this->currentlyPlaying.firstArtistUri, (char *)firstArtist["uri"].as<const char *>(), 63);
-
-            strncpy(this->currentlyPlaying.albumName, (char *)item["album"]["name"].as<const char *>(), 63);
-            strncpy(this->currentlyPlaying.albumUri, (char *)item["album"]["uri"].as<const char *>(), 63);
-
-            strncpy(this->currentlyPlaying.trackName, (char *)item["name"].as<const char *>(), 63);
-            strncpy(this->currentlyPlaying.trackUri, (char *)item["uri"].as<const char *>(), 63);
-
-            strncpy(this->currentlyPlaying.imgUrl, (char *)item["album"]["images"][0]["url"].as<char *>(), 64);
-
-            this->currentlyPlaying.isPlaying = doc["is_playing"].as<bool>();
-
-            this->currentlyPlaying.progressMs = doc["progress_ms"].as<long>();
-            this->currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
-
-            this->currentlyPlaying.error = false;
+            _parseCurrentlyPlaying(doc.as<JsonObject>());
         }
         else
         {
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
+            setParseError(error);
         }
 	doc.clear();
     }
     closeClient();
+
+    // 204 means nothing is playing, that's a change worth knowing about too.
+    // Done after closing so the callback is free to make requests.
+    if (!this->currentlyPlaying.error || statusCode == 204)
+    {
+        _notifyChanges(_diffCurrentlyPlaying());
+    }
     return &(this->currentlyPlaying);
 }
 
 PlayerDetails* ArduinoSpotify::getPlayerDetails(const char *market)
 {
+    // Controls the user is waiting on go before background polls
+    runQueuedActions();
   _initDeviceStruct();
-  memset(command, 0, 125*sizeof(char));
-  strncpy(command, SPOTIFY_PLAYER_ENDPOINT, 124);
+    command.setPath(SPOTIFY_PLAYER_ENDPOINT);
     if (market[0] != 0)
     {
-        char marketBuff[11];
-	memset(marketBuff, 0, 11*sizeof(char));
-        sprintf(marketBuff, "?market=%s", market);
-        strncat(command, marketBuff, (100-10-1));
+        command.addParam("market", market);
     }
 
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
-
-    // Get from https://arduinojson.org/v6/assistant/
-    //const size_t bufferSize = playerDetailsBufferSize;
-//    PlayerDetails playerDetails;
     // This flag will get cleared if all goes well
     this->playerDetails.error = true;
-    if (autoTokenRefresh)
-    {
-        checkAndRefreshAccessToken();
-    }
-
-    int statusCode = makeGetRequest(command, this->_bearerToken);
-    if (statusCode > 0)
-    {
-        skipHeaders();
-    }
 
+    int statusCode = sendApiRequest(NULL);
     if (statusCode == 200)
     {
-        // Allocate DynamicJsonDocument
-        //DynamicJsonDocument doc(bufferSize);
+        // The response has the whole item too, we don't need it here
+        StaticJsonDocument<256> filter;
+        addPlayerDetailsFilter(filter.to<JsonObject>());
 
         // Parse JSON object
-        DeserializationError error = deserializeJson(doc, *client);
+        DeserializationError error = deserializeResponse(&filter);
         if (!error)
         {
-            JsonObject device = doc["device"];
-            
-            strncpy(this->playerDetails.device.id, (char *)device["id"].as<const char *>(), 40);
-            strncpy(this->playerDetails.device.name, (char *)device["name"].as<const char *>(), 40);
-            strncpy(this->playerDetails.device.type, (char *)device["type"].as<const char *>(), 19);
-            this->playerDetails.device.isActive = device["is_active"].as<bool>();
-            this->playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
-            this->playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
-            this->playerDetails.device.volumePercent = device["volume_percent"].as<int>();
+            _parsePlayerDetails(doc.as<JsonObject>());
+        }
+        else
+        {
+            setParseError(error);
+        }
+	doc.clear();
+    }
+    closeClient();
+
+    if (!this->playerDetails.error)
+    {
+        _notifyChanges(_diffPlayerDetails());
+    }
+    return &(this->playerDetails);
+}
 
-            this->playerDetails.progressMs = doc["progress_ms"].as<long>();
-            this->playerDetails.isPlaying = doc["is_playing"].as<bool>();
+// /v1/me/player has everything currently-playing does plus the device
+// and modes, so one request fills both structs
+const SpotifyResult &ArduinoSpotify::getPlayerState(const char *market)
+{
+    // Controls the user is waiting on go before background polls
+    runQueuedActions();
+    _initCurrentlyPlayingStruct(this->currentlyPlaying);
+    _initDeviceStruct();
 
-            this->playerDetails.shuffleState = doc["shuffle_state"].as<bool>();
+    command.setPath(SPOTIFY_PLAYER_ENDPOINT);
+    if (market[0] != 0)
+    {
+        command.addParam("market", market);
+    }
+    command.addParam("additional_types", "episode");
 
-            const char *repeat_state = doc["repeat_state"]; // "off"
+    // These flags will get cleared if all goes well
+    this->currentlyPlaying.error = true;
+    this->playerDetails.error = true;
 
-            if (strncmp(repeat_state, "track", 5) == 0)
-            {
-                this->playerDetails.repeateState = repeat_track;
-            }
-            else if (strncmp(repeat_state, "context", 7) == 0)
-            {
-                this->playerDetails.repeateState = repeat_context;
-            }
-            else
-            {
-                this->playerDetails.repeateState = repeat_off;
-            }
+    int statusCode = sendApiRequest(NULL);
+    if (statusCode == 200)
+    {
+        StaticJsonDocument<768> filter;
+        JsonObject filterRoot = filter.to<JsonObject>();
+        addCurrentlyPlayingFilter(filterRoot);
+        addPlayerDetailsFilter(filterRoot);
 
-            this->playerDetails.error = false;
+        DeserializationError error = deserializeResponse(&filter);
+        if (!error)
+        {
+            JsonObject root = doc.as<JsonObject>();
+            _parseCurrentlyPlaying(root);
+            _parsePlayerDetails(root);
         }
         else
         {
-			Serial.println("Pipan gick det");
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
+            setParseError(error);
         }
-	doc.clear();
+        doc.clear();
     }
     closeClient();
-    return &(this->playerDetails);
+
+    // One callback with everything that changed, 204 (no active device)
+    // counts as nothing playing like it does for getCurrentlyPlaying()
+    if (!this->currentlyPlaying.error)
+    {
+        _notifyChanges(_diffCurrentlyPlaying() | _diffPlayerDetails());
+    }
+    else if (statusCode == 204)
+    {
+        _notifyChanges(_diffCurrentlyPlaying());
+    }
+    return _lastResult;
+}
+
+void ArduinoSpotify::_parseCurrentlyPlaying(JsonObject root)
+{
+    const char *type = root["currently_playing_type"] | "";
+    if (strcmp(type, "track") == 0)
+    {
+        this->currentlyPlaying.type = spotify_playing_track;
+    }
+    else if (strcmp(type, "episode") == 0)
+    {
+        this->currentlyPlaying.type = spotify_playing_episode;
+    }
+    else if (strcmp(type, "ad") == 0)
+    {
+        this->currentlyPlaying.type = spotify_playing_ad;
+    }
+    else
+    {
+        this->currentlyPlaying.type = spotify_playing_unknown;
+    }
+
+    // item is null for ads and sometimes for unknown types,
+    // everything below then copies empty strings
+    JsonObject item = root["item"];
+    JsonObject album = item["album"];
+    JsonObject firstArtist = album["artists"][0];
+    const char *imageUrl = album["images"][0]["url"];
+    if (this->currentlyPlaying.type == spotify_playing_episode)
+    {
+        album = item["show"];
+        firstArtist = album;
+        imageUrl = item["images"][0]["url"] | album["images"][0]["url"].as<const char *>();
+    }
+
+    copyJsonString(this->currentlyPlaying.firstArtistName, firstArtist[(this->currentlyPlaying.type == spotify_playing_episode) ? "publisher" : "name"], SPOTIFY_NAME_SIZE);
+#ifndef SPOTIFY_NO_URIS
+    if (this->currentlyPlaying.type != spotify_playing_episode)
+    {
+        copyJsonString(this->currentlyPlaying.firstArtistUri, firstArtist["uri"], SPOTIFY_URI_SIZE);
+    }
+#endif
+
+#ifndef SPOTIFY_NO_ALBUM_NAME
+    copyJsonString(this->currentlyPlaying.albumName, album["name"], SPOTIFY_NAME_SIZE);
+#endif
+#ifndef SPOTIFY_NO_URIS
+    copyJsonString(this->currentlyPlaying.albumUri, album["uri"], SPOTIFY_URI_SIZE);
+#endif
+
+    copyJsonString(this->currentlyPlaying.trackName, item["name"], SPOTIFY_NAME_SIZE);
+    copyJsonString(this->currentlyPlaying.trackUri, item["uri"], SPOTIFY_URI_SIZE);
+
+    copyJsonString(this->currentlyPlaying.imgUrl, imageUrl, SPOTIFY_IMAGE_URL_SIZE);
+
+    this->currentlyPlaying.isPlaying = root["is_playing"].as<bool>();
+
+    this->currentlyPlaying.progressMs = root["progress_ms"].as<long>();
+    this->currentlyPlaying.duraitonMs = item["duration_ms"].as<long>();
+    _currentlyPlayingAt = millis();
+
+    this->currentlyPlaying.error = false;
+}
+
+void ArduinoSpotify::_parsePlayerDetails(JsonObject root)
+{
+    JsonObject device = root["device"];
+
+    copyJsonString(this->playerDetails.device.id, device["id"], sizeof(this->playerDetails.device.id));
+    copyJsonString(this->playerDetails.device.name, device["name"], sizeof(this->playerDetails.device.name));
+    copyJsonString(this->playerDetails.device.type, device["type"], sizeof(this->playerDetails.device.type));
+    this->playerDetails.device.isActive = device["is_active"].as<bool>();
+    this->playerDetails.device.isPrivateSession = device["is_private_session"].as<bool>();
+    this->playerDetails.device.isRestricted = device["is_restricted"].as<bool>();
+    this->playerDetails.device.volumePercent = device["volume_percent"].as<int>();
+
+    this->playerDetails.progressMs = root["progress_ms"].as<long>();
+    this->playerDetails.isPlaying = root["is_playing"].as<bool>();
+
+    this->playerDetails.shuffleState = root["shuffle_state"].as<bool>();
+
+    const char *repeat_state = root["repeat_state"] | "off";
+
+    if (strncmp(repeat_state, "track", 5) == 0)
+    {
+        this->playerDetails.repeateState = repeat_track;
+    }
+    else if (strncmp(repeat_state, "context", 7) == 0)
+    {
+        this->playerDetails.repeateState = repeat_context;
+    }
+    else
+    {
+        this->playerDetails.repeateState = repeat_off;
+    }
+
+    this->playerDetails.error = false;
 }
 
-bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
+const SpotifyResult &ArduinoSpotify::getImage(char *imageUrl, Stream *file)
 {
 #ifdef SPOTIFY_DEBUG
     Serial.print(F("Parsing image URL: "));
     Serial.println(imageUrl);
 #endif
 
+    // Controls the user is waiting on go before background downloads
+    runQueuedActions();
+
     uint8_t lengthOfString = strlen(imageUrl);
 
     // We are going to just assume https, that's all I've
@@ -647,10 +999,14 @@ bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
 
     if (strncmp(imageUrl, "https://", 8) != 0)
     {
+#ifdef SPOTIFY_DEBUG
         Serial.print(F("Url not in expected format: "));
         Serial.println(imageUrl);
         Serial.println("(expected it to start with \"https://\")");
-        return false;
+#endif
+        resetResult();
+        setResultError(spotify_error_request);
+        return _lastResult;
     }
 
     uint8_t protocolLength = 8;
@@ -683,231 +1039,1544 @@ bool ArduinoSpotify::getImage(char *imageUrl, Stream *file)
     Serial.println(strlen(path));
 #endif
 
-    bool status = false;
-    int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host);
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("statusCode: "));
-    Serial.println(statusCode);
-#endif
-    if (statusCode == 200)
+    long totalLength = -1;
+    long received = 0;
+    uint8_t resumes = 0;
+    do
     {
-        int totalLength = getContentLength();
+        // After a drop only ask for the part we are missing
+        _rangeStart = (received > 0) ? received : -1;
+        int statusCode = makeGetRequest(path, NULL, "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8", host);
+        _rangeStart = -1;
 #ifdef SPOTIFY_DEBUG
-        Serial.print(F("file length: "));
-        Serial.println(totalLength);
-#endif
-        if (totalLength > 0)
-        {
-            skipHeaders(false);
-            int remaining = totalLength;
-            // This section of code is inspired but the "Web_Jpg"
-            // example of TJpg_Decoder
-            // https://github.com/Bodmer/TJpg_Decoder
-            // -----------
-            uint8_t buff[128] = {0};
-            while (client->connected() && (remaining > 0 || remaining == -1))
-            {
-                // Get available data size
-                size_t size = client->available();
-
-                if (size)
+        Serial.print(F("statusCode: "));
+        Serial.println(statusCode);
+#endif
+        if (statusCode <= 0 || !skipHeaders(false))
+        {
+            // Couldn't connect or the response got cut off, worth another go
+            closeClient();
+            continue;
+        }
+
+        long skip = 0;
+        if (statusCode == 200)
+        {
+            // The whole file, either the first request or the server
+            // ignored the range, then what we already have is dropped
+            long length = getContentLength();
+            if (length <= 0 || (totalLength > 0 && length != totalLength))
+            {
+                setResultError(spotify_error_response);
+                break;
+            }
+            totalLength = length;
+            skip = received;
+        }
+        else if (statusCode != 206 || _contentRangeStart != received)
+        {
+            // Image servers don't send Spotify style error bodies
+            setResultError(statusCode == 206 ? spotify_error_response : spotify_error_http);
+            break;
+        }
+
+#ifdef SPOTIFY_DEBUG
+        Serial.print(F("file length: "));
+        Serial.print(totalLength);
+        Serial.print(F(", starting at: "));
+        Serial.println(received);
+#endif
+        received += _readImageBody(file, totalLength - received, skip);
+        closeClient();
+
+        if (_lastResult.phase == spotify_error_aborted || _lastResult.phase == spotify_error_write || received >= totalLength)
+        {
+            // Given way to an action, the file is full or it has it all
+            break;
+        }
+#ifdef SPOTIFY_DEBUG
+        Serial.print(F("Image download dropped at "));
+        Serial.println(received);
+#endif
+    } while (resumes++ < SPOTIFY_IMAGE_MAX_RESUMES);
+
+    // Only a complete file counts as success
+    if (_lastResult.phase == spotify_error_none && (totalLength <= 0 || received != totalLength))
+    {
+        setResultError(spotify_error_response);
+    }
+
+    closeClient();
+
+    if (_lastResult.phase == spotify_error_aborted)
+    {
+        // Keep reporting the abort, not the result of the actions
+        SpotifyResult imageResult = _lastResult;
+        runQueuedActions();
+        _lastResult = imageResult;
+    }
+
+    return _lastResult;
+}
+
+// Copies `remaining` bytes of the body to the file, dropping the first
+// `skip` bytes before them. Stops early if the connection drops, nothing
+// arrives for SPOTIFY_TIMEOUT, a queued action needs the connection or
+// the file takes less than it's given (spotify_error_write).
+// Returns how many bytes went to the file.
+//
+// Reads in slices, each one takes whatever has arrived up to the
+// SPOTIFY_SLICE_MS/SPOTIFY_SLICE_BYTES budget before the poll callback
+// and a yield. When nothing has arrived it waits a ms rather than
+// spinning on available().
+long ArduinoSpotify::_readImageBody(Stream *file, long remaining, long skip)
+{
+    long written = 0;
+    unsigned long lastData = millis();
+
+    // This section of code is inspired but the "Web_Jpg"
+    // example of TJpg_Decoder
+    // https://github.com/Bodmer/TJpg_Decoder
+    // -----------
+    uint8_t buff[SPOTIFY_READ_BUFFER];
+    while ((remaining > 0 || skip > 0) && (client->connected() || client->available()))
+    {
+        unsigned long sliceStart = millis();
+#ifdef SPOTIFY_STATS
+        uint32_t sliceStartUs = micros();
+#endif
+        size_t sliceBytes = 0;
+        size_t size = client->available();
+        while (size > 0 && (remaining > 0 || skip > 0))
+        {
+            long wanted = (skip > 0) ? skip : remaining;
+            if ((long)size > wanted)
+            {
+                size = wanted;
+            }
+            if (size > sizeof(buff))
+            {
+                size = sizeof(buff);
+            }
+
+            int c = client->read(buff, size);
+            if (c <= 0)
+            {
+                break;
+            }
+            sliceBytes += c;
+
+            if (skip > 0)
+            {
+                skip -= c;
+            }
+            else
+            {
+                // Write it to file
+                size_t taken = file->write(buff, c);
+                written += taken;
+                remaining -= taken;
+                if (taken != (size_t)c)
                 {
-                    // Read up to 128 bytes
-                    int c = client->readBytes(buff, ((size > sizeof(buff)) ? sizeof(buff) : size));
+#ifdef SPOTIFY_DEBUG
+                    Serial.println(F("Image file is full"));
+#endif
+                    setResultError(spotify_error_write);
+                    break;
+                }
+            }
+
+            if (sliceBytes >= SPOTIFY_SLICE_BYTES || millis() - sliceStart >= SPOTIFY_SLICE_MS)
+            {
+                break;
+            }
+            size = client->available();
+        }
+
+        if (sliceBytes > 0)
+        {
+            lastData = millis();
+            SPOTIFY_STAT(addReceived(sliceBytes));
+            SPOTIFY_STAT(addSlice(sliceBytes, micros() - sliceStartUs, lastData - sliceStart > SPOTIFY_SLICE_MS));
+            if (_lastResult.phase == spotify_error_write)
+            {
+                break;
+            }
+        }
+        else if (millis() - lastData > SPOTIFY_TIMEOUT)
+        {
+            // Still connected but nothing is coming, treat it as a drop
+            break;
+        }
+
+        if (_shouldGiveWay())
+        {
+#ifdef SPOTIFY_DEBUG
+            Serial.println(F("Dropping the image download for a queued action"));
+#endif
+            setResultError(spotify_error_aborted);
+            break;
+        }
+
+        if (sliceBytes > 0)
+        {
+            yield();
+        }
+        else
+        {
+            // Nothing yet, let the network stack (and on the ESP32 the
+            // lower priority tasks) have the time
+            SPOTIFY_STAT(addIdleSpin());
+            delay(1);
+        }
+    }
+    // ---------
+    return written;
+}
+
+int ArduinoSpotify::getContentLength()
+{
+    // Picked up by skipHeaders()
+    return _contentLength;
+}
+
+bool ArduinoSpotify::skipHeaders(bool tossUnexpectedForJSON)
+{
+    _contentLength = -1;
+    _contentRangeStart = -1;
+    _bodyChunked = false;
+    _bodyGzipped = false;
+
+    // Headers are read a line at a time, the few we are interested
+    // in are kept and the rest are skipped over
+    char line[64];
+    while (true)
+    {
+        size_t length = client->readBytesUntil('\n', line, sizeof(line) - 1);
+        if (length == 0)
+        {
+#ifdef SPOTIFY_DEBUG
+            Serial.println(F("Invalid response"));
+#endif
+            setResultError(spotify_error_response);
+            return false;
+        }
+        SPOTIFY_STAT(addReceived(length + 1));
+        line[length] = 0;
+
+        if (length == sizeof(line) - 1)
+        {
+            // Longer than the buffer, the rest of it is of no use to us
+            client->find("\n");
+        }
+
+        if (line[0] == '\r')
+        {
+            // Blank line, end of the headers
+            break;
+        }
+
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+        {
+            _contentLength = atol(line + 15);
+#ifdef SPOTIFY_DEBUG
+            Serial.print(F("Content-Length: "));
+            Serial.println(_contentLength);
+#endif
+        }
+        else if (strncasecmp(line, "Content-Range:", 14) == 0)
+        {
+            // "Content-Range: bytes 1234-5678/5679", we only need the start
+            char *start = strstr(line + 14, "bytes ");
+            _contentRangeStart = (start != NULL) ? atol(start + 6) : -1;
+        }
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            _bodyChunked = (strstr(line + 18, "chunked") != NULL);
+        }
+        else if (strncasecmp(line, "Content-Encoding:", 17) == 0)
+        {
+            _bodyGzipped = (strstr(line + 17, "gzip") != NULL);
+        }
+        else if (strncasecmp(line, "Retry-After:", 12) == 0)
+        {
+            _lastResult.retryAfterSeconds = strtoul(line + 12, NULL, 10);
+        }
+    }
+    SPOTIFY_STAT(mark(spotify_phase_headers));
+
+    // An encoded body doesn't start with the JSON
+    if (tossUnexpectedForJSON && !_bodyChunked && !_bodyGzipped)
+    {
+        // Was getting stray characters between the headers and the body
+        // This should toss them away. available() is asked once, it can
+        // be expensive on secure clients.
+        int waiting = client->available();
+        size_t tossed = 0;
+        while (waiting-- > 0 && client->peek() != '{')
+        {
+            int c = client->read();
+            tossed++;
+#ifdef SPOTIFY_DEBUG
+            Serial.print(F("Tossing an unexpected character: "));
+            Serial.println((char)c);
+#endif
+            (void)c;
+        }
+        SPOTIFY_STAT(addReceived(tossed));
+        (void)tossed;
+    }
+    return true;
+}
+
+int ArduinoSpotify::getHttpStatusCode()
+{
+    char status[32] = {0};
+    size_t statusLength = client->readBytesUntil('\r', status, sizeof(status) - 1);
+    if (statusLength > 0)
+    {
+        // Rest of the status line, so the headers start on a fresh line
+        client->find("\n");
+    }
+    SPOTIFY_STAT(addReceived(statusLength));
+    SPOTIFY_STAT(mark(spotify_phase_first_byte));
+    (void)statusLength;
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("Status: "));
+    Serial.println(status);
+#endif
+
+    char *token;
+    token = strtok(status, " "); // https://www.tutorialspoint.com/c_standard_library/c_function_strtok.htm
+
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("HTTP Version: "));
+    Serial.println(token);
+#endif
+
+    if (token != NULL && (strcmp(token, "HTTP/1.0") == 0 || strcmp(token, "HTTP/1.1") == 0))
+    {
+        token = strtok(NULL, " ");
+        if (token != NULL)
+        {
+#ifdef SPOTIFY_DEBUG
+            Serial.print(F("Status Code: "));
+            Serial.println(token);
+#endif
+            _lastResult.httpStatus = atoi(token);
+            SPOTIFY_STAT(setStatusCode(_lastResult.httpStatus));
+            return _lastResult.httpStatus;
+        }
+    }
+
+    setResultError(spotify_error_response);
+    return -1;
+}
+
+void ArduinoSpotify::parseError()
+{
+    setResultError(spotify_error_http);
+    if (_contentLength == 0)
+    {
+        return;
+    }
+
+    // The Web API sends {"error": {"status": 401, "message": "..."}},
+    // the accounts service {"error": "...", "error_description": "..."}.
+    // The filter keeps just those no matter what else comes with them.
+    StaticJsonDocument<64> filter;
+    filter["error"] = true;
+    filter["error_description"] = true;
+
+    DeserializationError error = deserializeResponse(&filter);
+    if (!error)
+    {
+        const char *message = doc["error"]["message"].as<const char *>();
+        if (message == NULL)
+        {
+            message = doc["error_description"].as<const char *>();
+        }
+        if (message == NULL)
+        {
+            message = doc["error"].as<const char *>();
+        }
+        if (message != NULL)
+        {
+            strncpy(_lastResult.message, message, SPOTIFY_ERROR_MESSAGE_SIZE - 1);
+            _lastResult.message[SPOTIFY_ERROR_MESSAGE_SIZE - 1] = 0;
+        }
+#ifdef SPOTIFY_DEBUG
+        Serial.print(F("Error response: "));
+        Serial.println(_lastResult.message);
+#endif
+    }
+    doc.clear();
+}
+
+void ArduinoSpotify::resetResult()
+{
+    _lastResult.phase = spotify_error_none;
+    _lastResult.httpStatus = -1;
+    _lastResult.jsonError = DeserializationError::Ok;
+    _lastResult.retryAfterSeconds = 0;
+    _lastResult.message[0] = 0;
+}
+
+void ArduinoSpotify::setResultError(SpotifyErrorPhase phase)
+{
+    _lastResult.phase = phase;
+}
+
+void ArduinoSpotify::setParseError(DeserializationError error)
+{
+#ifdef SPOTIFY_DEBUG
+    Serial.print(F("deserializeJson() failed with code "));
+    Serial.println(error.c_str());
+#endif
+    _lastResult.jsonError = error;
+    setResultError(spotify_error_parse);
+}
+
+const SpotifyResult &ArduinoSpotify::getLastResult()
+{
+    return _lastResult;
+}
+
+size_t ArduinoSpotify::getDocumentPeak()
+{
+    return _docPeak;
+}
+
+void ArduinoSpotify::resetDocumentPeak()
+{
+    _docPeak = 0;
+}
+
+// Sends the request built up in command to the Web API, refreshing the
+// access token first if it's due. The headers are read before returning
+// so the body is ready to be parsed, non 2xx error bodies are parsed here.
+int ArduinoSpotify::sendApiRequest(const char *type, const char *body)
+{
+    if (command.truncated())
+    {
+#ifdef SPOTIFY_DEBUG
+        Serial.println(F("Request path too long"));
+#endif
+        resetResult();
+        setResultError(spotify_error_request);
+        return -1;
+    }
+
+#ifdef SPOTIFY_DEBUG
+    Serial.println(command.c_str());
+#endif
+
+    if (autoTokenRefresh)
+    {
+        checkAndRefreshAccessToken();
+    }
+
+    int statusCode = 0;
+    bool replayed = false;
+    while (true)
+    {
+        if (type == NULL)
+        {
+#ifdef SPOTIFY_GZIP
+            _acceptGzip = true;
+#endif
+            statusCode = makeGetRequest(command.c_str(), _session->bearerToken);
+        }
+        else
+        {
+            statusCode = makeRequestWithBody(type, command.c_str(), _session->bearerToken, body);
+        }
+
+        // The token can be revoked or expire before we expected it to
+        // (deep sleep, clock drift), so on a 401 get a new one and send
+        // the same request again, but only once.
+        if (statusCode == 401 && !replayed && autoTokenRefresh && _session->refreshToken[0] != 0)
+        {
+#ifdef SPOTIFY_DEBUG
+            Serial.println(F("Got a 401, refreshing the token and trying again"));
+#endif
+            closeClient();
+            replayed = true;
+            if (refreshAccessToken())
+            {
+                continue;
+            }
+            // The result of the failed refresh is kept
+            return statusCode;
+        }
+        break;
+    }
+
+    if (statusCode > 0 && skipHeaders() && (statusCode < 200 || statusCode > 299))
+    {
+        parseError();
+    }
+    return statusCode;
+}
+
+void ArduinoSpotify::closeClient()
+{
+    if (client->connected())
+    {
+#ifdef SPOTIFY_DEBUG
+        Serial.println(F("Closing client"));
+#endif
+        client->stop();
+    }
+    // Error bodies are read too, anything else failed before the body
+    SPOTIFY_STAT(end(_lastResult.phase == spotify_error_none || _lastResult.phase == spotify_error_http));
+}
+
+// The body with the chunk framing and gzip undone. Without SPOTIFY_GZIP
+// we never ask for gzip, if it comes anyway the parse fails on it.
+Stream &ArduinoSpotify::bodyStream(Stream &raw)
+{
+    Stream *body = &raw;
+    if (_bodyChunked)
+    {
+        _chunked.begin(*body);
+        body = &_chunked;
+    }
+#ifdef SPOTIFY_GZIP
+    if (_bodyGzipped)
+    {
+        _inflate.begin(*body);
+        body = &_inflate;
+    }
+#endif
+    return *body;
+}
+
+DeserializationError ArduinoSpotify::deserializeResponse(const JsonDocument *filter)
+{
+#ifdef SPOTIFY_STATS
+    SpotifyCountingStream counted(*client);
+    Stream &input = bodyStream(counted);
+#else
+    Stream &input = bodyStream(*client);
+#endif
+
+    DeserializationError error;
+    if (filter != NULL)
+    {
+        error = deserializeJson(doc, input, DeserializationOption::Filter(*filter));
+    }
+    else
+    {
+        error = deserializeJson(doc, input);
+    }
+    if (doc.memoryUsage() > _docPeak)
+    {
+        _docPeak = doc.memoryUsage();
+    }
+
+    SPOTIFY_STAT(addReceived(counted.count));
+    return error;
+}
+
+// Like deserializeResponse() but for responses too big for the doc
+bool ArduinoSpotify::scanResponse(SpotifyJsonScanner &scanner)
+{
+#ifdef SPOTIFY_STATS
+    SpotifyCountingStream counted(*client);
+    Stream &input = bodyStream(counted);
+#else
+    Stream &input = bodyStream(*client);
+#endif
+
+    // Content-Length is of the encoded body
+    long length = (_bodyChunked || _bodyGzipped) ? -1 : _contentLength;
+    bool complete = scanner.parse(input, length);
+    SPOTIFY_STAT(addReceived(counted.count));
+    return complete || scanner.stopped();
+}
+
+#ifdef SPOTIFY_STATS
+SpotifyRequestStats &ArduinoSpotify::getRequestStats()
+{
+    return _stats;
+}
+#endif
+
+// Track endpoints take the id, so the "spotify:track:" part is dropped
+void ArduinoSpotify::setTrackPath(const char *endpoint, const char *trackUri)
+{
+    const char *id = strrchr(trackUri, ':');
+    command.setPath(endpoint);
+    command.appendPath((id != NULL) ? id + 1 : trackUri);
+}
+
+struct SpotifySearchCollector
+{
+    SpotifySearchResult *results;
+    uint8_t count;
+    int ranks[SPOTIFY_SEARCH_RESULTS];
+    SpotifySearchResult current;
+    bool inItem;
+};
+
+static SpotifySearchType searchTypeFor(const char *key)
+{
+    const char *types[] = {"tracks", "albums", "artists", "playlists", "shows", "episodes"};
+    for (uint8_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strcmp(key, types[i]) == 0)
+        {
+            return (SpotifySearchType)i;
+        }
+    }
+    return spotify_search_unknown;
+}
+
+// Fills in one item at a time, {"tracks": {"items": [{...}]}}, and
+// keeps the best ranked ones, i.e. lowest position in their list.
+static void onSearchValue(SpotifyJsonScanner &scanner, SpotifyJsonType type, const char *value, void *context)
+{
+    SpotifySearchCollector &collector = *(SpotifySearchCollector *)context;
+    if (scanner.depth() < 3 || !scanner.keyIs(1, "items"))
+    {
+        return;
+    }
+
+    if (scanner.depth() == 3 && type == spotify_json_object_start)
+    {
+        memset(&collector.current, 0, sizeof(SpotifySearchResult));
+        collector.current.type = searchTypeFor(scanner.key(0));
+        collector.inItem = true;
+        return;
+    }
+    if (!collector.inItem)
+    {
+        return;
+    }
+
+    if (scanner.depth() == 3 && type == spotify_json_object_end)
+    {
+        collector.inItem = false;
+        // Rank by position in its own list, then by type
+        int rank = scanner.index(2) * (spotify_search_unknown + 1) + collector.current.type;
+        uint8_t at = collector.count;
+        while (at > 0 && collector.ranks[at - 1] > rank)
+        {
+            at--;
+        }
+        if (at >= SPOTIFY_SEARCH_RESULTS)
+        {
+            return;
+        }
+        uint8_t last = (collector.count < SPOTIFY_SEARCH_RESULTS) ? collector.count : SPOTIFY_SEARCH_RESULTS - 1;
+        for (uint8_t i = last; i > at; i--)
+        {
+            collector.results[i] = collector.results[i - 1];
+            collector.ranks[i] = collector.ranks[i - 1];
+        }
+        collector.results[at] = collector.current;
+        collector.ranks[at] = rank;
+        if (collector.count < SPOTIFY_SEARCH_RESULTS)
+        {
+            collector.count++;
+        }
+        return;
+    }
+
+    if (type != spotify_json_string)
+    {
+        return;
+    }
+    if (scanner.depth() == 4 && scanner.keyIs(3, "name"))
+    {
+        strncpy(collector.current.name, value, SPOTIFY_NAME_SIZE - 1);
+    }
+    else if (scanner.depth() == 4 && scanner.keyIs(3, "uri"))
+    {
+        strncpy(collector.current.uri, value, SPOTIFY_URI_SIZE - 1);
+    }
+    else if ((scanner.depth() == 6 && scanner.keyIs(3, "images") && scanner.keyIs(5, "url")) ||
+             (scanner.depth() == 7 && scanner.keyIs(3, "album") && scanner.keyIs(4, "images") && scanner.keyIs(6, "url")))
+    {
+        // Images are widest first, so the last one wins
+        strncpy(collector.current.imageUrl, value, SPOTIFY_IMAGE_URL_SIZE - 1);
+    }
+}
+
+#ifdef SPOTIFY_UP_NEXT
+// Picks the first item of the queue out of the response
+static void onQueueValue(SpotifyJsonScanner &scanner, SpotifyJsonType type, const char *value, void *context)
+{
+    CurrentlyPlaying &next = *(CurrentlyPlaying *)context;
+    if (scanner.depth() < 2 || !scanner.keyIs(0, "queue") || scanner.index(1) != 0)
+    {
+        return;
+    }
+
+    if (scanner.depth() == 2)
+    {
+        if (type == spotify_json_object_start)
+        {
+            next.error = false;
+        }
+        else if (type == spotify_json_object_end)
+        {
+            // The rest of the queue is of no use
+            scanner.stop();
+        }
+        return;
+    }
+
+    if (type == spotify_json_number && scanner.depth() == 3 && scanner.keyIs(2, "duration_ms"))
+    {
+        next.duraitonMs = atol(value);
+        return;
+    }
+    if (type != spotify_json_string)
+    {
+        return;
+    }
+
+    // Tracks have an album, episodes a show, never both. The first
+    // image is the biggest, like getCurrentlyPlaying() uses.
+    uint8_t depth = scanner.depth();
+    if (depth == 3)
+    {
+        if (scanner.keyIs(2, "name"))
+        {
+            copyJsonString(next.trackName, value, SPOTIFY_NAME_SIZE);
+        }
+        else if (scanner.keyIs(2, "uri"))
+        {
+            copyJsonString(next.trackUri, value, SPOTIFY_URI_SIZE);
+        }
+        else if (scanner.keyIs(2, "type"))
+        {
+            next.type = (strcmp(value, "episode") == 0) ? spotify_playing_episode : spotify_playing_track;
+        }
+    }
+    else if (depth == 4 && (scanner.keyIs(2, "album") || scanner.keyIs(2, "show")))
+    {
+#ifndef SPOTIFY_NO_ALBUM_NAME
+        if (scanner.keyIs(3, "name"))
+        {
+            copyJsonString(next.albumName, value, SPOTIFY_NAME_SIZE);
+        }
+#endif
+#ifndef SPOTIFY_NO_URIS
+        if (scanner.keyIs(3, "uri"))
+        {
+            copyJsonString(next.albumUri, value, SPOTIFY_URI_SIZE);
+        }
+#endif
+        if (scanner.keyIs(3, "publisher"))
+        {
+            copyJsonString(next.firstArtistName, value, SPOTIFY_NAME_SIZE);
+        }
+    }
+    else if (depth == 5 && scanner.keyIs(2, "images") && scanner.index(3) == 0 && scanner.keyIs(4, "url"))
+    {
+        // An episode's own image beats its show's
+        copyJsonString(next.imgUrl, value, SPOTIFY_IMAGE_URL_SIZE);
+    }
+    else if (depth == 6 && scanner.index(4) == 0)
+    {
+        if (scanner.keyIs(3, "images") && scanner.keyIs(5, "url") && (scanner.keyIs(2, "album") || next.imgUrl[0] == 0))
+        {
+            copyJsonString(next.imgUrl, value, SPOTIFY_IMAGE_URL_SIZE);
+        }
+        else if (scanner.keyIs(2, "album") && scanner.keyIs(3, "artists") && scanner.keyIs(5, "name"))
+        {
+            copyJsonString(next.firstArtistName, value, SPOTIFY_NAME_SIZE);
+        }
+#ifndef SPOTIFY_NO_URIS
+        else if (scanner.keyIs(2, "album") && scanner.keyIs(3, "artists") && scanner.keyIs(5, "uri"))
+        {
+            copyJsonString(next.firstArtistUri, value, SPOTIFY_URI_SIZE);
+        }
+#endif
+    }
+}
+
+const SpotifyResult &ArduinoSpotify::getQueue()
+{
+    // Controls the user is waiting on go before background polls
+    runQueuedActions();
+    _initCurrentlyPlayingStruct(this->upNext);
+
+    command.setPath(SPOTIFY_QUEUE_ENDPOINT);
+
+    // It's the whole queue plus the current track, far too much for the
+    // doc, so it's scanned and only the first item kept
+    int statusCode = sendApiRequest(NULL);
+    if (statusCode == 200)
+    {
+        SpotifyJsonScanner scanner(onQueueValue, &this->upNext);
+        if (!scanResponse(scanner))
+        {
+            this->upNext.error = true;
+            setResultError(spotify_error_parse);
+        }
+    }
+    closeClient();
+    return _lastResult;
+}
+#endif
+
+long ArduinoSpotify::msToTrackEnd()
+{
+    if (this->currentlyPlaying.error || this->currentlyPlaying.duraitonMs <= 0)
+    {
+        return -1;
+    }
+    long progress = this->currentlyPlaying.progressMs;
+    if (this->currentlyPlaying.isPlaying)
+    {
+        progress += millis() - _currentlyPlayingAt;
+    }
+    long remaining = this->currentlyPlaying.duraitonMs - progress;
+    return (remaining > 0) ? remaining : 0;
+}
+
+#ifdef SPOTIFY_UP_NEXT
+bool ArduinoSpotify::prefetchNext(Stream *artFile)
+{
+    if (!this->currentlyPlaying.isPlaying)
+    {
+        return false;
+    }
+    long remaining = msToTrackEnd();
+    if (remaining < 0 || remaining > SPOTIFY_PREFETCH_MS)
+    {
+        return false;
+    }
+
+    // Once per track that worked
+    uint32_t trackHash = spotifyHash(this->currentlyPlaying.trackUri);
+    if (trackHash == _prefetchedFor)
+    {
+        return false;
+    }
+
+    if (!getQueue())
+    {
+        return false;
+    }
+    if (this->upNext.error)
+    {
+        // Nothing queued, that's an answer too
+        _prefetchedFor = trackHash;
+        return false;
+    }
+    if (artFile != NULL && this->upNext.imgUrl[0] != 0)
+    {
+        if (!getImage(this->upNext.imgUrl, artFile))
+        {
+            return false;
+        }
+    }
+    _prefetchedFor = trackHash;
+    return true;
+}
+#endif
+
+const SpotifyResult &ArduinoSpotify::search(const char *query, const char *types, int limit, SpotifySearchCallback callback, const char *market)
+{
+    // Controls the user is waiting on go before background requests
+    runQueuedActions();
+
+    command.setPath(SPOTIFY_SEARCH_ENDPOINT);
+    command.addParam("q", query);
+    command.addParam("type", types);
+    command.addParam("limit", limit);
+    if (market[0] != 0)
+    {
+        command.addParam("market", market);
+    }
+
+    SpotifySearchResult results[SPOTIFY_SEARCH_RESULTS];
+    SpotifySearchCollector collector;
+    collector.results = results;
+    collector.count = 0;
+    collector.inItem = false;
+
+    int statusCode = sendApiRequest(NULL);
+    if (statusCode == 200)
+    {
+        SpotifyJsonScanner scanner(onSearchValue, &collector);
+        if (!scanResponse(scanner))
+        {
+            setResultError(spotify_error_parse);
+        }
+    }
+    closeClient();
+
+    // Results are only passed on once the connection is closed, so the
+    // callback can go ahead and play one
+    if (callback != NULL && collector.count > 0)
+    {
+        SpotifyResult searchResult = _lastResult;
+        for (uint8_t i = 0; i < collector.count; i++)
+        {
+            callback(*this, results[i], i);
+        }
+        _lastResult = searchResult;
+    }
+    return _lastResult;
+}
+
+SpotifyAudioFeatures* ArduinoSpotify::getAudioFeatures(const char *trackUri)
+{
+    // Controls the user is waiting on go before background polls
+    runQueuedActions();
+    memset(&this->audioFeatures, 0, sizeof(SpotifyAudioFeatures));
+    this->audioFeatures.key = -1;
+    // This flag will get cleared if all goes well
+    this->audioFeatures.error = true;
+
+    setTrackPath(SPOTIFY_AUDIO_FEATURES_ENDPOINT, trackUri);
+
+    int statusCode = sendApiRequest(NULL);
+    if (statusCode == 200)
+    {
+        // The response also has a handful of URLs and ids we don't need
+        StaticJsonDocument<192> filter;
+        filter["tempo"] = true;
+        filter["danceability"] = true;
+        filter["energy"] = true;
+        filter["valence"] = true;
+        filter["loudness"] = true;
+        filter["key"] = true;
+        filter["mode"] = true;
+        filter["time_signature"] = true;
+        filter["duration_ms"] = true;
+
+        DeserializationError error = deserializeResponse(&filter);
+        if (!error)
+        {
+            this->audioFeatures.tempo = doc["tempo"].as<float>();
+            this->audioFeatures.danceability = doc["danceability"].as<float>();
+            this->audioFeatures.energy = doc["energy"].as<float>();
+            this->audioFeatures.valence = doc["valence"].as<float>();
+            this->audioFeatures.loudness = doc["loudness"].as<float>();
+            this->audioFeatures.key = doc["key"].as<int>();
+            this->audioFeatures.major = doc["mode"].as<int>() == 1;
+            this->audioFeatures.timeSignature = doc["time_signature"].as<int>();
+            this->audioFeatures.durationMs = doc["duration_ms"].as<long>();
+
+            this->audioFeatures.error = false;
+        }
+        else
+        {
+            setParseError(error);
+        }
+        doc.clear();
+    }
+    closeClient();
+    return &(this->audioFeatures);
+}
+
+struct SpotifyAnalysisWriter
+{
+    ArduinoSpotify *spotify;
+    Print *file;
+    char list; // the one being written, 0 before the first
+    uint8_t done; // bit per finished list
+    bool writeFailed;
+    bool gaveWay; // stopped for a queued action
+    unsigned long sliceStart;
+};
+
+static void writeAnalysisValue(SpotifyAnalysisWriter &writer, uint32_t value)
+{
+    if (writer.file->write((const uint8_t *)&value, sizeof(value)) != sizeof(value))
+    {
+        writer.writeFailed = true;
+    }
+}
+
+// Picks the start times out of the bars, beats and sections as they go
+// past, everything else (segments and tatums are most of it) is skipped.
+void ArduinoSpotify::_onAnalysisValue(SpotifyJsonScanner &scanner, SpotifyJsonType type, const char *value, void *context)
+{
+    SpotifyAnalysisWriter &writer = *(SpotifyAnalysisWriter *)context;
+
+    // The whole response is read in this one scan, so every
+    // SPOTIFY_SLICE_MS the sketch gets a turn like it does between the
+    // slices of an image download
+    if (millis() - writer.sliceStart >= SPOTIFY_SLICE_MS)
+    {
+        if (writer.spotify->_shouldGiveWay())
+        {
+            writer.gaveWay = true;
+            scanner.stop();
+            return;
+        }
+        yield();
+        writer.sliceStart = millis();
+    }
 
-                    // Write it to file
-                    file->write(buff, c);
+    char list = 0;
+    if (scanner.keyIs(0, "beats"))
+    {
+        list = spotify_analysis_beats;
+    }
+    else if (scanner.keyIs(0, "bars"))
+    {
+        list = spotify_analysis_bars;
+    }
+    else if (scanner.keyIs(0, "sections"))
+    {
+        list = spotify_analysis_sections;
+    }
+    if (list == 0)
+    {
+        return;
+    }
+    uint8_t bit = (list == spotify_analysis_beats) ? 0x01 : ((list == spotify_analysis_bars) ? 0x02 : 0x04);
 
-                    // Calculate remaining bytes
-                    if (remaining > 0)
-                    {
-                        remaining -= c;
-                    }
-                }
-                yield();
-            }
-// ---------
+    if (type == spotify_json_array_start && scanner.depth() == 1)
+    {
+        uint8_t tag = list;
+        writer.writeFailed |= (writer.file->write(&tag, 1) != 1);
+        writer.list = list;
+    }
+    else if (type == spotify_json_array_end && scanner.depth() == 1)
+    {
+        writeAnalysisValue(writer, SPOTIFY_ANALYSIS_LIST_END);
+        writer.list = 0;
+        writer.done |= bit;
+        // No need to download the rest once we have all three
+        if (writer.done == 0x07)
+        {
+            scanner.stop();
+        }
+    }
+    else if (type == spotify_json_number && scanner.depth() == 3 && scanner.keyIs(2, "start") && writer.list == list)
+    {
+        // seconds to ms
+        writeAnalysisValue(writer, (uint32_t)(atof(value) * 1000.0 + 0.5));
+    }
+
+    if (writer.writeFailed)
+    {
+        scanner.stop();
+    }
+}
+
+const SpotifyResult &ArduinoSpotify::getAudioAnalysis(const char *trackUri, Print *file)
+{
+    // Controls the user is waiting on go before background downloads
+    runQueuedActions();
+    setTrackPath(SPOTIFY_AUDIO_ANALYSIS_ENDPOINT, trackUri);
+
+    int statusCode = sendApiRequest(NULL);
+    if (statusCode == 200)
+    {
+        const char magic[] = "SPBA";
+        uint32_t key = spotifyHash(trackUri);
+        file->write((const uint8_t *)magic, 4);
+        file->write((const uint8_t *)&key, sizeof(key));
+
+        SpotifyAnalysisWriter writer;
+        writer.spotify = this;
+        writer.file = file;
+        writer.list = 0;
+        writer.done = 0;
+        writer.writeFailed = false;
+        writer.gaveWay = false;
+        writer.sliceStart = millis();
+        SpotifyJsonScanner scanner(_onAnalysisValue, &writer);
+        bool complete = scanResponse(scanner);
+
+        uint8_t end = spotify_analysis_end;
+        file->write(&end, 1);
 #ifdef SPOTIFY_DEBUG
-            Serial.println(F("Finished getting image"));
+        Serial.print(F("Scanned analysis bytes: "));
+        Serial.println(scanner.bytesRead());
 #endif
-            // probably?!
-            status = true;
+        if (writer.gaveWay)
+        {
+#ifdef SPOTIFY_DEBUG
+            Serial.println(F("Dropping the audio analysis for a queued action"));
+#endif
+            setResultError(spotify_error_aborted);
+        }
+        else if (writer.writeFailed)
+        {
+            setResultError(spotify_error_write);
+        }
+        else if (!complete || writer.done != 0x07)
+        {
+            setResultError(spotify_error_parse);
         }
     }
-
     closeClient();
 
-    return status;
+    if (_lastResult.phase == spotify_error_aborted)
+    {
+        // Keep reporting the abort, not the result of the actions
+        SpotifyResult analysisResult = _lastResult;
+        runQueuedActions();
+        _lastResult = analysisResult;
+    }
+    return _lastResult;
 }
 
-int ArduinoSpotify::getContentLength()
+SpotifyDevice* ArduinoSpotify::scanDevices()
 {
-
-    if (client->find("Content-Length:"))
+  _initDeviceStruct();
+#ifdef SPOTIFY_DEVICE_LIST
+    if (getDevices(true) > 0)
     {
-        int contentLength = client->parseInt();
-#ifdef SPOTIFY_DEBUG
-        Serial.print(F("Content-Length: "));
-        Serial.println(contentLength);
+        this->playerDetails.device = _devices[0];
+    }
+#else
+    runQueuedActions();
+    _fetchDevices(&this->playerDetails.device, 1);
 #endif
-        return contentLength;
+    return &(this->playerDetails.device);
+}
+
+#ifdef SPOTIFY_DEVICE_LIST
+int ArduinoSpotify::getDevices(bool refresh)
+{
+    // Controls the user is waiting on go before background polls
+    runQueuedActions();
+
+    if (refresh || _lookupDevice(NULL) == NULL)
+    {
+        if (!_refreshDevices())
+        {
+            return -1;
+        }
     }
+    return _deviceCount;
+}
 
-    return -1;
+const SpotifyDevice &ArduinoSpotify::getDevice(uint8_t index)
+{
+    if (index >= _deviceCount)
+    {
+        // An empty one rather than a crash
+        static SpotifyDevice none;
+        return none;
+    }
+    return _devices[index];
 }
 
-void ArduinoSpotify::skipHeaders(bool tossUnexpectedForJSON)
+const char *ArduinoSpotify::findDevice(const char *nameOrType)
 {
-    // Skip HTTP headers
-    if (!client->find("\r\n\r\n"))
+    const SpotifyDevice *device = _lookupDevice(nameOrType);
+    if (device == NULL)
     {
-        Serial.println(F("Invalid response"));
-        return;
+        _refreshDevices();
+        device = _lookupDevice(nameOrType);
     }
+    return (device != NULL) ? device->id : NULL;
+}
+
+void ArduinoSpotify::invalidateDevices()
+{
+    _devicesValid = false;
+}
 
-    if (tossUnexpectedForJSON)
+// Looks for the device in the cached list only, NULL if it's not there
+// or the list is out of date. A NULL name just checks the list is usable.
+const SpotifyDevice *ArduinoSpotify::_lookupDevice(const char *nameOrType)
+{
+    if (!_devicesValid || millis() - _devicesFetchedAt > SPOTIFY_DEVICE_CACHE_MS)
     {
-        // Was getting stray characters between the headers and the body
-        // This should toss them away
-        while (client->available() && client->peek() != '{')
+        return NULL;
+    }
+    if (nameOrType == NULL)
+    {
+        return _devices;
+    }
+
+    for (uint8_t i = 0; i < _deviceCount; i++)
+    {
+        if (strcasecmp(_devices[i].name, nameOrType) == 0)
         {
-            char c = 0;
-            client->readBytes(&c, 1);
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("Tossing an unexpected character: "));
-            Serial.println(c);
-#endif
+            return &_devices[i];
         }
     }
+
+    // By type, the active one if there are a few of them
+    const SpotifyDevice *found = NULL;
+    for (uint8_t i = 0; i < _deviceCount; i++)
+    {
+        if (strcasecmp(_devices[i].type, nameOrType) == 0 && (found == NULL || _devices[i].isActive))
+        {
+            found = &_devices[i];
+        }
+    }
+    return found;
 }
 
-int ArduinoSpotify::getHttpStatusCode()
+bool ArduinoSpotify::_refreshDevices()
 {
-    char status[32] = {0};
-    client->readBytesUntil('\r', status, sizeof(status));
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("Status: "));
-    Serial.println(status);
+    _devicesValid = false;
+    int count = _fetchDevices(_devices, SPOTIFY_MAX_DEVICES);
+    if (count < 0)
+    {
+        _deviceCount = 0;
+        return false;
+    }
+    _deviceCount = count;
+    _devicesValid = true;
+    _devicesFetchedAt = millis();
+    return true;
+}
 #endif
 
-    char *token;
-    token = strtok(status, " "); // https://www.tutorialspoint.com/c_standard_library/c_function_strtok.htm
+// Fetches up to size devices, leaving command as it was so it can be
+// done in the middle of sending a control. Returns how many there were,
+// -1 if they couldn't be fetched.
+int ArduinoSpotify::_fetchDevices(SpotifyDevice *devices, uint8_t size)
+{
+    char saved[SPOTIFY_COMMAND_SIZE];
+    strcpy(saved, command.c_str());
 
-#ifdef SPOTIFY_DEBUG
-    Serial.print(F("HTTP Version: "));
-    Serial.println(token);
-#endif
+    int count = -1;
+    command.setPath(SPOTIFY_DEVICES_ENDPOINT);
 
-    if (token != NULL && (strcmp(token, "HTTP/1.0") == 0 || strcmp(token, "HTTP/1.1") == 0))
+    int statusCode = sendApiRequest(NULL);
+    if (statusCode == 200)
     {
-        token = strtok(NULL, " ");
-        if (token != NULL)
+        StaticJsonDocument<192> filter;
+        JsonObject deviceFilter = filter["devices"].createNestedObject();
+        deviceFilter["id"] = true;
+        deviceFilter["name"] = true;
+        deviceFilter["type"] = true;
+        deviceFilter["is_active"] = true;
+        deviceFilter["is_private_session"] = true;
+        deviceFilter["is_restricted"] = true;
+        deviceFilter["volume_percent"] = true;
+
+        // Parse JSON object
+        DeserializationError error = deserializeResponse(&filter);
+        if (!error)
         {
-#ifdef SPOTIFY_DEBUG
-            Serial.print(F("Status Code: "));
-            Serial.println(token);
-#endif
-            return atoi(token);
+            count = 0;
+            for (JsonObject device : doc["devices"].as<JsonArray>())
+            {
+                if (count >= size)
+                {
+                    break;
+                }
+                SpotifyDevice &entry = devices[count++];
+                copyJsonString(entry.id, device["id"], sizeof(entry.id));
+                copyJsonString(entry.name, device["name"], sizeof(entry.name));
+                copyJsonString(entry.type, device["type"], sizeof(entry.type));
+                entry.isActive = device["is_active"].as<bool>();
+                entry.isPrivateSession = device["is_private_session"].as<bool>();
+                entry.isRestricted = device["is_restricted"].as<bool>();
+                entry.volumePercent = device["volume_percent"].as<int>();
+            }
+        }
+        else
+        {
+            setParseError(error);
         }
+        doc.clear();
     }
+    closeClient();
 
-    return -1;
+    command.setPath(saved);
+    return count;
 }
 
-void ArduinoSpotify::parseError()
+void ArduinoSpotify::onChange(SpotifyChangeCallback callback, uint8_t mask)
 {
-/*
-    DynamicJsonDocument doc(1000);
-    DeserializationError error = deserializeJson(doc, *client);
-    if (!error)
+    _changeCallback = callback;
+    _changeMask = mask;
+
+    // Forget what we've seen, so the next response reports everything
+    _resetSnapshot(_session->snapshot);
+}
+
+void ArduinoSpotify::_resetSnapshot(SpotifySnapshot &snapshot)
+{
+    snapshot.trackHash = 0;
+    snapshot.albumArtHash = 0;
+    snapshot.deviceHash = 0;
+    snapshot.volumePercent = -1;
+    snapshot.isPlaying = 0xFF;
+    snapshot.modes = 0xFF;
+}
+
+uint8_t ArduinoSpotify::_diffCurrentlyPlaying()
+{
+    uint8_t changes = 0;
+
+    uint32_t trackHash = spotifyHash(currentlyPlaying.trackUri);
+    if (trackHash != _session->snapshot.trackHash)
     {
-        Serial.print(F("getAuthToken error"));
-        serializeJson(doc, Serial);
+        changes |= spotify_changed_track;
+        _session->snapshot.trackHash = trackHash;
     }
-    else
+
+    uint32_t albumArtHash = spotifyHash(currentlyPlaying.imgUrl);
+    if (albumArtHash != _session->snapshot.albumArtHash)
     {
-        Serial.print(F("Could not parse error"));
+        changes |= spotify_changed_album_art;
+        _session->snapshot.albumArtHash = albumArtHash;
     }
-    doc.clear();
-*/
+
+    if (currentlyPlaying.isPlaying != _session->snapshot.isPlaying)
+    {
+        changes |= spotify_changed_play_state;
+        _session->snapshot.isPlaying = currentlyPlaying.isPlaying;
+    }
+
+    return changes;
 }
 
-void ArduinoSpotify::closeClient()
+uint8_t ArduinoSpotify::_diffPlayerDetails()
 {
-    if (client->connected())
+    uint8_t changes = 0;
+
+    uint32_t deviceHash = spotifyHash(playerDetails.device.id);
+    if (deviceHash != _session->snapshot.deviceHash)
     {
-#ifdef SPOTIFY_DEBUG
-        Serial.println(F("Closing client"));
-#endif
-        client->stop();
+        changes |= spotify_changed_device;
+        _session->snapshot.deviceHash = deviceHash;
+    }
+
+    if (playerDetails.device.volumePercent != _session->snapshot.volumePercent)
+    {
+        changes |= spotify_changed_volume;
+        _session->snapshot.volumePercent = playerDetails.device.volumePercent;
+    }
+
+    if (playerDetails.isPlaying != _session->snapshot.isPlaying)
+    {
+        changes |= spotify_changed_play_state;
+        _session->snapshot.isPlaying = playerDetails.isPlaying;
+    }
+
+    uint8_t modes = (playerDetails.shuffleState ? 1 : 0) | (playerDetails.repeateState << 1);
+    if (modes != _session->snapshot.modes)
+    {
+        changes |= spotify_changed_modes;
+        _session->snapshot.modes = modes;
     }
+
+    return changes;
 }
 
-SpotifyDevice* ArduinoSpotify::scanDevices()
+void ArduinoSpotify::_notifyChanges(uint8_t changes)
 {
-  _initDeviceStruct();
-  memset(command, 0, 125*sizeof(char));
-  strncpy(command, "/v1/me/player/devices", 124);
-
-#ifdef SPOTIFY_DEBUG
-    Serial.println(command);
-#endif
+    changes &= _changeMask;
+    if (changes != 0 && _changeCallback != NULL)
+    {
+        _changeCallback(*this, changes);
+    }
+}
 
-    // Get from https://arduinojson.org/v6/assistant/
-    //const size_t bufferSize = currentlyPlayingBufferSize/5;
-    // This flag will get cleared if all goes well
-    if (autoTokenRefresh)
+bool ArduinoSpotify::queueAction(SpotifyAction action, long value, const char *deviceId)
+{
+    if (_actionCount >= SPOTIFY_ACTION_QUEUE_SIZE)
     {
-        checkAndRefreshAccessToken();
+        return false;
     }
 
-    int statusCode = makeGetRequest(command, this->_bearerToken);
-    if (statusCode > 0)
+    SpotifyQueuedAction &queued = _actions[_actionCount++];
+    queued.action = action;
+    queued.value = value;
+    memset(queued.deviceId, 0, 41*sizeof(char));
+    strncpy(queued.deviceId, deviceId, 40);
+    return true;
+}
+
+bool ArduinoSpotify::hasQueuedActions()
+{
+    return _actionCount > 0;
+}
+
+uint8_t ArduinoSpotify::runQueuedActions()
+{
+    if (_runningActions)
     {
-        skipHeaders();
+        return 0;
     }
+    _runningActions = true;
 
-    if (statusCode == 200)
+    uint8_t failed = 0;
+    while (_actionCount > 0)
     {
-        // Allocate DynamicJsonDocument
-        //DynamicJsonDocument doc(bufferSize);
+        // Take it off the queue first, the callback might queue another
+        SpotifyQueuedAction queued = _actions[0];
+        _actionCount--;
+        memmove(_actions, _actions + 1, _actionCount * sizeof(SpotifyQueuedAction));
 
-        // Parse JSON object
-        DeserializationError error = deserializeJson(doc, *client);
-        if (!error)
+        const SpotifyResult *result = NULL;
+        switch (queued.action)
         {
-          for (uint8_t i=0; i<1; i++) {
-            strncpy(this->playerDetails.device.id, (char *)doc["devices"][i]["id"].as<const char *>(), 40);
-	        this->playerDetails.device.isActive = doc["devices"][i]["id"]["is_active"].as<bool>();
-            this->playerDetails.device.isPrivateSession = doc["devices"][i]["id"]["is_private_session"].as<bool>();
-            this->playerDetails.device.isRestricted = doc["devices"][i]["id"]["is_restricted"].as<bool>();
-            strncpy(playerDetails.device.name, (char *)doc["devices"][i]["name"].as<const char *>(), 40);
-            strncpy(playerDetails.device.type, (char *)doc["devices"][i]["type"].as<const char *>(), 19);
-            this->playerDetails.device.volumePercent = doc["devices"][i]["volume_percent"].as<int>();
-          }
-/*
-struct SpotifyDevice
+        case spotify_action_play:
+            result = &play(queued.deviceId);
+            break;
+        case spotify_action_pause:
+            result = &pause(queued.deviceId);
+            break;
+        case spotify_action_next:
+            result = &nextTrack(queued.deviceId);
+            break;
+        case spotify_action_previous:
+            result = &previousTrack(queued.deviceId);
+            break;
+        case spotify_action_volume:
+            result = &setVolume(queued.value, queued.deviceId);
+            break;
+        case spotify_action_shuffle:
+            result = &toggleShuffle(queued.value != 0, queued.deviceId);
+            break;
+        case spotify_action_repeat:
+            result = &setRepeatMode((RepeatOptions)queued.value, queued.deviceId);
+            break;
+        case spotify_action_seek:
+            result = &seek(queued.value, queued.deviceId);
+            break;
+        }
+
+        if (result == NULL)
+        {
+            continue;
+        }
+        if (!*result)
+        {
+            failed++;
+        }
+        if (_actionCallback != NULL)
+        {
+            _actionCallback(*this, queued.action, *result);
+        }
+    }
+
+    _runningActions = false;
+    return failed;
+}
+
+void ArduinoSpotify::setPollCallback(SpotifyPollCallback callback)
 {
-  char id[41];
-  char name[41];
-  char type[20];
-  bool isActive;
-  bool isRestricted;
-  bool isPrivateSession;
-  int volumePercent;
-};
-_devices[2];
-*/
+    _pollCallback = callback;
+}
+
+void ArduinoSpotify::onActionDone(SpotifyActionCallback callback)
+{
+    _actionCallback = callback;
+}
+
+// Checked between chunks of background transfers, true if one of them
+// should be dropped so queued actions can go first
+bool ArduinoSpotify::_shouldGiveWay()
+{
+    if (_runningActions)
+    {
+        return false;
+    }
+    if (_pollCallback != NULL)
+    {
+        _pollCallback(*this);
+    }
+    return _actionCount > 0;
+}
+
+void
+ArduinoSpotify::_initActions()
+{
+  _actionCount = 0;
+  _runningActions = false;
+  _pollCallback = NULL;
+  _actionCallback = NULL;
+}
+
+void ArduinoSpotify::setupSession(SpotifySession &session, const char *clientId, const char *clientSecret, const char *refreshToken, uint8_t priority)
+{
+  memset(&session, 0, sizeof(SpotifySession));
+  strncpy(session.clientId, clientId, 32);
+  strncpy(session.clientSecret, clientSecret, 32);
+  strncpy(session.refreshToken, refreshToken, (SIZEOFREFRES-1));
+  // timeTokenRefreshed and tokenTimeToLiveMs are 0 now, which makes
+  // the first checkAndRefreshAccessToken() get a token
+  session.priority = priority;
+  _resetSnapshot(session.snapshot);
+}
+
+bool ArduinoSpotify::addSession(SpotifySession &session)
+{
+    for (uint8_t i = 0; i < _sessionCount; i++)
+    {
+        if (_sessions[i] == &session)
+        {
+            return true;
         }
-        else
+    }
+    if (_sessionCount >= SPOTIFY_MAX_SESSIONS)
+    {
+        return false;
+    }
+    _sessions[_sessionCount++] = &session;
+    return true;
+}
+
+void ArduinoSpotify::useSession(SpotifySession *session)
+{
+    if (session == NULL)
+    {
+        session = &_defaultSession;
+    }
+#ifdef SPOTIFY_DEVICE_LIST
+    if (session != _session)
+    {
+        // The devices belong to the other account
+        invalidateDevices();
+    }
+#endif
+    _session = session;
+}
+
+SpotifySession *ArduinoSpotify::getSession()
+{
+    return _session;
+}
+
+SpotifySession *ArduinoSpotify::nextSession()
+{
+    if (_sessionCount == 0)
+    {
+        return _session;
+    }
+
+    // Smooth weighted round robin: every session earns its weight in
+    // credit each turn, the richest one goes and pays for it with the
+    // total. With equal priorities that is plain round robin.
+    int total = 0;
+    SpotifySession *best = NULL;
+    for (uint8_t i = 0; i < _sessionCount; i++)
+    {
+        SpotifySession *session = _sessions[i];
+        int weight = session->priority + 1;
+        session->credit += weight;
+        total += weight;
+        if (best == NULL || session->credit > best->credit)
         {
-            Serial.print(F("deserializeJson() failed with code "));
-            Serial.println(error.c_str());
+            best = session;
         }
-	doc.clear();
     }
-    closeClient();
-    return &(this->playerDetails.device);
+    best->credit -= total;
+
+    useSession(best);
+    return best;
+}
+
+void
+ArduinoSpotify::_initSessions()
+{
+  _session = &_defaultSession;
+  _sessionCount = 0;
 }
 
 void
@@ -946,18 +2615,25 @@ struct PlayerDetails
 }
 
 void
-ArduinoSpotify::_initCurrentlyPlayingStruct()
-{
-  memset(this->currentlyPlaying.firstArtistName, 0, 64*sizeof(char));
-  memset(this->currentlyPlaying.firstArtistUri, 0, 64*sizeof(char));
-  memset(this->currentlyPlaying.albumName, 0, 64*sizeof(char));
-  memset(this->currentlyPlaying.albumUri, 0, 64*sizeof(char));
-  memset(this->currentlyPlaying.trackName, 0, 64*sizeof(char));
-  memset(this->currentlyPlaying.trackUri, 0, 64*sizeof(char));
-  memset(this->currentlyPlaying.imgUrl, 0, 65*sizeof(char));
-  this->currentlyPlaying.isPlaying = 0;
-  this->currentlyPlaying.progressMs = 0;
-  this->currentlyPlaying.duraitonMs = 0;
-
-  this->currentlyPlaying.error = true;
+ArduinoSpotify::_initCurrentlyPlayingStruct(CurrentlyPlaying &playing)
+{
+  playing.type = spotify_playing_unknown;
+  memset(playing.firstArtistName, 0, SPOTIFY_NAME_SIZE*sizeof(char));
+#ifndef SPOTIFY_NO_URIS
+  memset(playing.firstArtistUri, 0, SPOTIFY_URI_SIZE*sizeof(char));
+#endif
+#ifndef SPOTIFY_NO_ALBUM_NAME
+  memset(playing.albumName, 0, SPOTIFY_NAME_SIZE*sizeof(char));
+#endif
+#ifndef SPOTIFY_NO_URIS
+  memset(playing.albumUri, 0, SPOTIFY_URI_SIZE*sizeof(char));
+#endif
+  memset(playing.trackName, 0, SPOTIFY_NAME_SIZE*sizeof(char));
+  memset(playing.trackUri, 0, SPOTIFY_URI_SIZE*sizeof(char));
+  memset(playing.imgUrl, 0, SPOTIFY_IMAGE_URL_SIZE*sizeof(char));
+  playing.isPlaying = 0;
+  playing.progressMs = 0;
+  playing.duraitonMs = 0;
+
+  playing.error = true;
 }
@@ -28,9 +28,29 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 //#define SPOTIFY_DEBUG 1
 
+// Uncomment to keep timings, byte counts and status codes of the last
+// SPOTIFY_STATS_HISTORY requests, see getRequestStats().
+// When it is commented out none of it gets compiled in.
+
+//#define SPOTIFY_STATS 1
+
+// Uncomment to ask for gzipped JSON responses, they are about a fifth of
+// the size so there is a lot less time spent waiting on the radio. The
+// inflate needs SPOTIFY_INFLATE_WINDOW (32KB) plus about 1KB of RAM, so
+// it's meant for the ESP32, an ESP8266 won't have the room.
+
+//#define SPOTIFY_GZIP 1
+
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <Client.h>
+#include "ArduinoSpotifyUrl.h"
+#include "ArduinoSpotifyHash.h"
+#include "ArduinoSpotifyStats.h"
+#include "ArduinoSpotifyArt.h"
+#include "ArduinoSpotifyJson.h"
+#include "ArduinoSpotifyBeats.h"
+#include "ArduinoSpotifyDecode.h"
 
 #define SPOTIFY_HOST "api.spotify.com"
 #define SPOTIFY_ACCOUNTS_HOST "accounts.spotify.com"
@@ -42,15 +62,167 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 #define SIZEOFACCESS 316
 #define SIZEOFREFRES 176
 
+// The capacities below can be changed to trade features for RAM.
+// Set them in your build flags (e.g. build_flags in platformio.ini) or
+// edit them here, the sketch and the library have to see the same values.
+// A #define in the sketch doesn't reach the library's .cpp files, so
+// don't set them there, the build fails to link if you do (see
+// SpotifyLayoutCheck below).
+// Define SPOTIFY_REPORT_FOOTPRINT to get the resulting sizes printed
+// as a compiler warning.
+
+// Size of the buffer all responses are parsed into
+#ifndef SPOTIFY_JSON_DOC_SIZE
+#define SPOTIFY_JSON_DOC_SIZE 2000
+#endif
+
+// Size of the buffer used to build request paths (path + query string)
+#ifndef SPOTIFY_COMMAND_SIZE
+#define SPOTIFY_COMMAND_SIZE 125
+#endif
+
+// Longest error message kept from an error response
+#ifndef SPOTIFY_ERROR_MESSAGE_SIZE
+#define SPOTIFY_ERROR_MESSAGE_SIZE 64
+#endif
+
+// Sizes of the strings in CurrentlyPlaying, including the terminator
+#ifndef SPOTIFY_NAME_SIZE
+#define SPOTIFY_NAME_SIZE 64
+#endif
+#ifndef SPOTIFY_URI_SIZE
+#define SPOTIFY_URI_SIZE 64
+#endif
+#ifndef SPOTIFY_IMAGE_URL_SIZE
+#define SPOTIFY_IMAGE_URL_SIZE 65
+#endif
+
+// Define these to drop fields of CurrentlyPlaying you don't use.
+// trackUri is always kept, it's what identifies the track.
+//#define SPOTIFY_NO_URIS 1       // firstArtistUri and albumUri
+//#define SPOTIFY_NO_ALBUM_NAME 1 // albumName
+
+// Define these to add the parts that take RAM whether they're used or
+// not, they're left out otherwise.
+//#define SPOTIFY_DEVICE_LIST 1 // getDevices(), findDevice() and controls by device name
+//#define SPOTIFY_UP_NEXT 1     // upNext, getQueue() and prefetchNext()
+
+// How many times getImage() reconnects to resume a dropped download
+#ifndef SPOTIFY_IMAGE_MAX_RESUMES
+#define SPOTIFY_IMAGE_MAX_RESUMES 3
+#endif
+
+// Budget of one slice of a body download: it reads whatever has arrived,
+// up to this many ms or bytes, then calls the poll callback and yields.
+// Smaller gives the rest of the sketch the CPU more often, bigger means
+// fewer round trips through the loop.
+#ifndef SPOTIFY_SLICE_MS
+#define SPOTIFY_SLICE_MS 20
+#endif
+#ifndef SPOTIFY_SLICE_BYTES
+#define SPOTIFY_SLICE_BYTES 2048
+#endif
+
+// Size of the stack buffer the slices are read through
+#ifndef SPOTIFY_READ_BUFFER
+#define SPOTIFY_READ_BUFFER 256
+#endif
+
+// Most results search() passes to its callback, they are kept on the
+// stack while the response is read
+#ifndef SPOTIFY_SEARCH_RESULTS
+#define SPOTIFY_SEARCH_RESULTS 5
+#endif
+
+// How many devices the device list (SPOTIFY_DEVICE_LIST) keeps, and how
+// long it is trusted before a lookup fetches it again
+#ifndef SPOTIFY_MAX_DEVICES
+#define SPOTIFY_MAX_DEVICES 6
+#endif
+#ifndef SPOTIFY_DEVICE_CACHE_MS
+#define SPOTIFY_DEVICE_CACHE_MS 300000
+#endif
+
+// How close to the end of a track prefetchNext() gets the next one
+#ifndef SPOTIFY_PREFETCH_MS
+#define SPOTIFY_PREFETCH_MS 15000
+#endif
+
+// How many player controls can wait in the action queue
+#ifndef SPOTIFY_ACTION_QUEUE_SIZE
+#define SPOTIFY_ACTION_QUEUE_SIZE 4
+#endif
+
+// How many extra accounts can be added with addSession()
+#ifndef SPOTIFY_MAX_SESSIONS
+#define SPOTIFY_MAX_SESSIONS 4
+#endif
+
+// Fails the build if an ArduinoSpotify object would be bigger than this
+//#define SPOTIFY_MAX_OBJECT_SIZE 3000
+
+// Everything that changes the layout of the structs and classes, so a
+// sketch compiled with different values than the library can be caught.
+// The optional parts count as 0 when they're left out.
+#ifdef SPOTIFY_NO_URIS
+#define SPOTIFY_LAYOUT_NO_URIS 1
+#else
+#define SPOTIFY_LAYOUT_NO_URIS 0
+#endif
+#ifdef SPOTIFY_NO_ALBUM_NAME
+#define SPOTIFY_LAYOUT_NO_ALBUM_NAME 1
+#else
+#define SPOTIFY_LAYOUT_NO_ALBUM_NAME 0
+#endif
+#ifdef SPOTIFY_UP_NEXT
+#define SPOTIFY_LAYOUT_UP_NEXT 1
+#else
+#define SPOTIFY_LAYOUT_UP_NEXT 0
+#endif
+#ifdef SPOTIFY_DEVICE_LIST
+#define SPOTIFY_LAYOUT_DEVICES SPOTIFY_MAX_DEVICES
+#else
+#define SPOTIFY_LAYOUT_DEVICES 0
+#endif
+#ifdef SPOTIFY_STATS
+#define SPOTIFY_LAYOUT_STATS SPOTIFY_STATS_HISTORY
+#else
+#define SPOTIFY_LAYOUT_STATS 0
+#endif
+#ifdef SPOTIFY_GZIP
+#define SPOTIFY_LAYOUT_GZIP SPOTIFY_INFLATE_WINDOW
+#else
+#define SPOTIFY_LAYOUT_GZIP 0
+#endif
+
+#define SPOTIFY_LAYOUT SpotifyLayout<                                   \
+    SPOTIFY_JSON_DOC_SIZE, SPOTIFY_COMMAND_SIZE,                        \
+    SPOTIFY_ERROR_MESSAGE_SIZE, SPOTIFY_NAME_SIZE, SPOTIFY_URI_SIZE,    \
+    SPOTIFY_IMAGE_URL_SIZE, SPOTIFY_LAYOUT_NO_URIS,                     \
+    SPOTIFY_LAYOUT_NO_ALBUM_NAME, SPOTIFY_LAYOUT_UP_NEXT,               \
+    SPOTIFY_LAYOUT_DEVICES, SPOTIFY_ACTION_QUEUE_SIZE,                  \
+    SPOTIFY_MAX_SESSIONS, SPOTIFY_LAYOUT_STATS, SPOTIFY_LAYOUT_GZIP,    \
+    SPOTIFY_ART_MAX_PALETTE, SPOTIFY_ART_MAX_COLOURS,                   \
+    SPOTIFY_ART_COLOUR_CACHE, SPOTIFY_BEAT_CLOCK_BEATS,                 \
+    SPOTIFY_BEAT_CLOCK_BARS, SPOTIFY_BEAT_CLOCK_SECTIONS,               \
+    SPOTIFY_JSON_SCAN_DEPTH, SPOTIFY_JSON_SCAN_KEY_SIZE,                \
+    SPOTIFY_JSON_SCAN_VALUE_SIZE>
+
 #define SPOTIFY_CURRENTLY_PLAYING_ENDPOINT "/v1/me/player/currently-playing"
 
 #define SPOTIFY_PLAYER_ENDPOINT "/v1/me/player"
 
 #define SPOTIFY_PLAY_ENDPOINT "/v1/me/player/play"
 #define SPOTIFY_PAUSE_ENDPOINT "/v1/me/player/pause"
-#define SPOTIFY_VOLUME_ENDPOINT "/v1/me/player/volume?volume_percent=%d"
-#define SPOTIFY_SHUFFLE_ENDPOINT "/v1/me/player/shuffle?state=%s"
-#define SPOTIFY_REPEAT_ENDPOINT "/v1/me/player/repeat?state=%s"
+#define SPOTIFY_VOLUME_ENDPOINT "/v1/me/player/volume"
+#define SPOTIFY_SHUFFLE_ENDPOINT "/v1/me/player/shuffle"
+#define SPOTIFY_REPEAT_ENDPOINT "/v1/me/player/repeat"
+#define SPOTIFY_DEVICES_ENDPOINT "/v1/me/player/devices"
+#define SPOTIFY_AUDIO_FEATURES_ENDPOINT "/v1/audio-features/"
+#define SPOTIFY_AUDIO_ANALYSIS_ENDPOINT "/v1/audio-analysis/"
+#define SPOTIFY_QUEUE_ENDPOINT "/v1/me/player/queue"
+
+#define SPOTIFY_SEARCH_ENDPOINT "/v1/search"
 
 #define SPOTIFY_NEXT_TRACK_ENDPOINT "/v1/me/player/next"
 #define SPOTIFY_PREVIOUS_TRACK_ENDPOINT "/v1/me/player/previous"
@@ -63,6 +235,15 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
 
 #define SPOTIFY_NUM_ALBUM_IMAGES 3
 
+// What getCurrentlyPlaying() found, from currently_playing_type
+enum SpotifyPlayingType
+{
+  spotify_playing_track,
+  spotify_playing_episode, // podcast episode
+  spotify_playing_ad,      // no item details during ads
+  spotify_playing_unknown
+};
+
 enum RepeatOptions
 {
   repeat_track,
@@ -70,6 +251,100 @@ enum RepeatOptions
   repeat_off
 };
 
+// Where a request went wrong, spotify_error_none if it didn't
+enum SpotifyErrorPhase
+{
+  spotify_error_none,
+  spotify_error_request,  // request could not be built, e.g. the URL was too long
+  spotify_error_connect,  // could not connect to the host
+  spotify_error_send,     // writing the request failed
+  spotify_error_response, // no valid status line or headers came back
+  spotify_error_http,     // the server answered with a non 2xx status
+  spotify_error_parse,    // the body could not be deserialized
+  spotify_error_aborted,  // a background transfer gave way to a queued action
+  spotify_error_write     // the output file took less than it was given, e.g. it's full
+};
+
+struct SpotifyResult
+{
+  SpotifyErrorPhase phase;
+  int httpStatus;                 // -1 until a status line has been read
+  DeserializationError jsonError;
+  unsigned long retryAfterSeconds; // Retry-After header (sent with 429s), 0 if missing
+  char message[SPOTIFY_ERROR_MESSAGE_SIZE]; // error message from the response body
+
+  // So results can still be used as a plain success flag
+  operator bool() const
+  {
+    return phase == spotify_error_none;
+  }
+};
+
+// Flags passed to the change callback, see onChange()
+enum SpotifyChange
+{
+  spotify_changed_track = 0x01,
+  spotify_changed_album_art = 0x02,
+  spotify_changed_play_state = 0x04,
+  spotify_changed_volume = 0x08,
+  spotify_changed_device = 0x10,
+  spotify_changed_modes = 0x20, // shuffle or repeat
+  spotify_changed_all = 0x3F
+};
+
+class ArduinoSpotify;
+typedef void (*SpotifyChangeCallback)(ArduinoSpotify &spotify, uint8_t changes);
+
+// What the last parsed responses looked like, hashed so it's cheap to keep
+struct SpotifySnapshot
+{
+  uint32_t trackHash;
+  uint32_t albumArtHash;
+  uint32_t deviceHash;
+  int volumePercent;
+  uint8_t isPlaying; // 0xFF until known
+  uint8_t modes;     // shuffle bit + repeat state << 1, 0xFF until known
+};
+
+// Player controls that can be queued with queueAction()
+enum SpotifyAction
+{
+  spotify_action_play,
+  spotify_action_pause,
+  spotify_action_next,
+  spotify_action_previous,
+  spotify_action_volume,  // value is the volume percent
+  spotify_action_shuffle, // value is 0 or 1
+  spotify_action_repeat,  // value is a RepeatOptions
+  spotify_action_seek     // value is the position in ms
+};
+
+struct SpotifyQueuedAction
+{
+  SpotifyAction action;
+  long value;
+  char deviceId[41];
+};
+
+typedef void (*SpotifyPollCallback)(ArduinoSpotify &spotify);
+typedef void (*SpotifyActionCallback)(ArduinoSpotify &spotify, SpotifyAction action, const SpotifyResult &result);
+
+// Credentials and tokens of one account. Everything else (client,
+// parse buffer, result structs) is shared by all the sessions of an
+// ArduinoSpotify, so each extra account only costs one of these.
+struct SpotifySession
+{
+  char clientId[33];
+  char clientSecret[33];
+  char refreshToken[SIZEOFREFRES];
+  char bearerToken[SIZEOFACCESS];
+  unsigned long timeTokenRefreshed;
+  unsigned long tokenTimeToLiveMs;
+  SpotifySnapshot snapshot; // so onChange() diffs each account on its own
+  uint8_t priority;         // relative share of nextSession() turns, 0 is lowest
+  int credit;               // used by nextSession()
+};
+
 struct SpotifyImage
 {
   int height;
@@ -88,6 +363,41 @@ struct SpotifyDevice
   int volumePercent;
 };
 
+enum SpotifySearchType
+{
+  spotify_search_track,
+  spotify_search_album,
+  spotify_search_artist,
+  spotify_search_playlist,
+  spotify_search_show,
+  spotify_search_episode,
+  spotify_search_unknown
+};
+
+struct SpotifySearchResult
+{
+  SpotifySearchType type;
+  char name[SPOTIFY_NAME_SIZE];
+  char uri[SPOTIFY_URI_SIZE];
+  char imageUrl[SPOTIFY_IMAGE_URL_SIZE]; // smallest image, "" if none
+};
+
+typedef void (*SpotifySearchCallback)(ArduinoSpotify &spotify, const SpotifySearchResult &result, uint8_t index);
+
+struct SpotifyAudioFeatures
+{
+  float tempo; // bpm
+  float danceability; // 0.0 - 1.0 for these
+  float energy;
+  float valence;
+  float loudness; // dB
+  int key;        // pitch class, -1 if not detected
+  bool major;
+  int timeSignature;
+  long durationMs;
+  bool error;
+};
+
 struct PlayerDetails
 {
   SpotifyDevice device;
@@ -100,31 +410,58 @@ struct PlayerDetails
   bool error;
 };
 
+// For podcast episodes the track fields hold the episode, the album
+// fields the show and the artist name is the show's publisher.
 struct CurrentlyPlaying
 {
-  char firstArtistName[64];
-  char firstArtistUri[64];
-  char albumName[64];
-  char albumUri[64];
-  char trackName[64];
-  char trackUri[64];
-  char imgUrl[65];
+  SpotifyPlayingType type;
+  char firstArtistName[SPOTIFY_NAME_SIZE];
+#ifndef SPOTIFY_NO_URIS
+  char firstArtistUri[SPOTIFY_URI_SIZE];
+#endif
+#ifndef SPOTIFY_NO_ALBUM_NAME
+  char albumName[SPOTIFY_NAME_SIZE];
+#endif
+#ifndef SPOTIFY_NO_URIS
+  char albumUri[SPOTIFY_URI_SIZE];
+#endif
+  char trackName[SPOTIFY_NAME_SIZE];
+  char trackUri[SPOTIFY_URI_SIZE];
+  char imgUrl[SPOTIFY_IMAGE_URL_SIZE];
   bool isPlaying;
   long progressMs;
   long duraitonMs;
   bool error;
 };
 
+// Only the library defines SpotifyLayout<...>::matched, for the values
+// it was compiled with. The constructors take a SpotifyLayoutCheck made
+// where they're called, so a sketch compiled with other values refers
+// to one that doesn't exist and the link fails with "undefined reference
+// to SpotifyLayout<...>::matched". The numbers in it are the sketch's
+// values, in the order of SPOTIFY_LAYOUT above.
+template <unsigned long... Values>
+struct SpotifyLayout
+{
+  static const char matched;
+};
+
+struct SpotifyLayoutCheck
+{
+  SpotifyLayoutCheck() : matched(SPOTIFY_LAYOUT::matched) {}
+  char matched;
+};
+
 class ArduinoSpotify
 {
 public:
-  ArduinoSpotify(Client &client);
-  ArduinoSpotify(Client &client, char *bearerToken);
-  ArduinoSpotify(Client &client, const char *clientId, const char *clientSecret, const char *refreshToken = "");
+  ArduinoSpotify(Client &client, SpotifyLayoutCheck layout = SpotifyLayoutCheck());
+  ArduinoSpotify(Client &client, char *bearerToken, SpotifyLayoutCheck layout = SpotifyLayoutCheck());
+  ArduinoSpotify(Client &client, const char *clientId, const char *clientSecret, const char *refreshToken = "", SpotifyLayoutCheck layout = SpotifyLayoutCheck());
 
   // Auth Methods
   void setRefreshToken(const char *refreshToken);
-  bool refreshAccessToken();
+  const SpotifyResult &refreshAccessToken();
   bool checkAndRefreshAccessToken();
   const char *requestAccessTokens(const char *code, const char *redirectUrl);
   const char *getAccessToken();
@@ -132,6 +469,17 @@ public:
   void setClientId(const char *clientId);
   void setClientSecret(const char *clientSecret);
 
+  // Multiple accounts
+  // Each session holds the credentials and tokens of one account, all
+  // requests are made for the active one. The sessions are owned by the
+  // sketch, the ones passed to addSession() must stay around.
+  void setupSession(SpotifySession &session, const char *clientId, const char *clientSecret, const char *refreshToken, uint8_t priority = 0);
+  bool addSession(SpotifySession &session);
+  void useSession(SpotifySession *session); // NULL goes back to the constructor's account
+  SpotifySession *getSession();
+  // Makes the next added session active (round robin, weighted by priority) and returns it
+  SpotifySession *nextSession();
+
   // Generic Request Methods
   int makeGetRequest(const char *command,
 					 const char *authorization,
@@ -155,23 +503,113 @@ public:
 					 const char *host = SPOTIFY_HOST);
 
   // User methods
+  // The methods returning a struct flag failures with its error field,
+  // the details are available from getLastResult()
+  // The deviceId of the controls can be a device id, or the name or type
+  // ("Speaker", "Computer"...) of one of the account's devices, which is
+  // looked up in the device list.
   CurrentlyPlaying* getCurrentlyPlaying(const char *market = "");
   PlayerDetails* getPlayerDetails(const char *market = "");
-  bool play(const char *deviceId = "");
-  bool playAdvanced(char *body, const char *deviceId = "");
-  bool pause(const char *deviceId = "");
-  bool setVolume(int volume, const char *deviceId = "");
-  bool toggleShuffle(bool shuffle, const char *deviceId = "");
-  bool setRepeatMode(RepeatOptions repeat, const char *deviceId = "");
-  bool nextTrack(const char *deviceId = "");
-  bool previousTrack(const char *deviceId = "");
-  bool playerControl(char *command, const char *deviceId = "", const char *body = "");
-  bool playerNavigate(char *command, const char *deviceId = "");
-  bool seek(int position, const char *deviceId = "");
+  // Fills both currentlyPlaying and playerDetails from one request,
+  // cheaper than calling the two above back to back
+  const SpotifyResult &getPlayerState(const char *market = "");
+  const SpotifyResult &play(const char *deviceId = "");
+  const SpotifyResult &playAdvanced(char *body, const char *deviceId = "");
+  const SpotifyResult &pause(const char *deviceId = "");
+  const SpotifyResult &setVolume(int volume, const char *deviceId = "");
+  const SpotifyResult &toggleShuffle(bool shuffle, const char *deviceId = "");
+  const SpotifyResult &setRepeatMode(RepeatOptions repeat, const char *deviceId = "");
+  const SpotifyResult &nextTrack(const char *deviceId = "");
+  const SpotifyResult &previousTrack(const char *deviceId = "");
+  const SpotifyResult &playerControl(const char *command, const char *deviceId = "", const char *body = "");
+  const SpotifyResult &playerNavigate(const char *command, const char *deviceId = "");
+  const SpotifyResult &seek(int position, const char *deviceId = "");
   SpotifyDevice* scanDevices();
 
-  // Image methods
-  bool getImage(char *imageUrl, Stream *file);
+#ifdef SPOTIFY_DEVICE_LIST
+  // The account's devices, fetched when the cached list is older than
+  // SPOTIFY_DEVICE_CACHE_MS or refresh is set. Returns how many there
+  // are, -1 if they couldn't be fetched.
+  int getDevices(bool refresh = false);
+  const SpotifyDevice &getDevice(uint8_t index);
+  // Id of the device with this name (or failing that, type), NULL if
+  // there isn't one. Only makes a request if it's not in the cached list.
+  const char *findDevice(const char *nameOrType);
+  void invalidateDevices();
+#endif
+
+#ifdef SPOTIFY_UP_NEXT
+  // Next item in the queue, into upNext (error set if the queue is
+  // empty). Only the first item of the response is read.
+  const SpotifyResult &getQueue();
+  // Call after polling, once the current track is within
+  // SPOTIFY_PREFETCH_MS of its end it gets the queue and, if a file is
+  // given, the next track's art. Returns true once upNext and the art
+  // are in, and doesn't do it again for that track. A failure returns
+  // false and is tried again on the next call, so start the file over
+  // before then. When the track changes to upNext the art is already
+  // there.
+  bool prefetchNext(Stream *artFile = NULL);
+#endif
+  // How long the current track has left, extrapolated since the last
+  // poll, -1 if nothing is playing
+  long msToTrackEnd();
+
+  // Search, types is a comma separated list ("track,album,artist") and
+  // limit is per type. The response is read as it arrives rather than
+  // parsed into the doc, so its size doesn't matter. The best
+  // SPOTIFY_SEARCH_RESULTS results (mixing the types by rank) are passed
+  // to the callback once the connection is closed.
+  const SpotifyResult &search(const char *query, const char *types, int limit, SpotifySearchCallback callback, const char *market = "");
+
+  // Track analysis, trackUri can be the URI or just the id
+  SpotifyAudioFeatures* getAudioFeatures(const char *trackUri);
+  // Streams the beats, bars and sections of the track into a compact
+  // binary file for SpotifyBeatClock, the JSON is hundreds of KB so it
+  // is never held in memory. A file that fills up ends it with
+  // spotify_error_write. Like getImage() it gives way to queued actions
+  // (spotify_error_aborted).
+  const SpotifyResult &getAudioAnalysis(const char *trackUri, Print *file);
+
+  // Image methods, a file that fills up ends the download with
+  // spotify_error_write
+  const SpotifyResult &getImage(char *imageUrl, Stream *file);
+
+  // Outcome of the last request
+  const SpotifyResult &getLastResult();
+
+  // Most of the JSON document any response has used since the last
+  // reset, to check SPOTIFY_JSON_DOC_SIZE against real responses
+  size_t getDocumentPeak();
+  void resetDocumentPeak();
+
+  // Prioritised player controls
+  // Queued actions run before the next background request (polls,
+  // device scans, images) and, if the poll callback queues one while an
+  // image or audio analysis is downloading, the download is aborted at
+  // the next chunk (spotify_error_aborted) so the action runs straight
+  // away.
+  // Don't queue from an interrupt, set a flag there and queue from the
+  // poll callback instead.
+  bool queueAction(SpotifyAction action, long value = 0, const char *deviceId = "");
+  bool hasQueuedActions();
+  // Runs everything in the queue, returns how many of them failed
+  uint8_t runQueuedActions();
+  // Called between chunks of background transfers, e.g. to read buttons
+  void setPollCallback(SpotifyPollCallback callback);
+  // Called with the result of each queued action
+  void onActionDone(SpotifyActionCallback callback);
+
+  // Called after getCurrentlyPlaying()/getPlayerDetails() when something
+  // in the mask changed since the last response, the callback gets the
+  // spotify_changed_* flags so only the affected parts need redrawing.
+  // The first response after setting it reports everything as changed.
+  void onChange(SpotifyChangeCallback callback, uint8_t mask = spotify_changed_all);
+
+#ifdef SPOTIFY_STATS
+  // Timings of the most recent requests
+  SpotifyRequestStats &getRequestStats();
+#endif
 
   int portNumber = 443;
   int tagArraySize = 10;
@@ -179,23 +617,81 @@ public:
   Client *client;
   struct CurrentlyPlaying currentlyPlaying;
   struct PlayerDetails playerDetails;
+  struct SpotifyAudioFeatures audioFeatures;
+#ifdef SPOTIFY_UP_NEXT
+  struct CurrentlyPlaying upNext; // see getQueue()
+#endif
 
 private:
-  StaticJsonDocument<2000> doc;
-  char command[125];
-  char _bearerToken[SIZEOFACCESS];
-  char _refreshToken[SIZEOFREFRES];
-  char _clientId[33];
-  char _clientSecret[33];
-  unsigned int timeTokenRefreshed;
-  unsigned int tokenTimeToLiveMs;
+  StaticJsonDocument<SPOTIFY_JSON_DOC_SIZE> doc;
+  SpotifyUrlBuilder<SPOTIFY_COMMAND_SIZE> command;
+  SpotifySession _defaultSession;
+  SpotifySession *_session;
+  SpotifySession *_sessions[SPOTIFY_MAX_SESSIONS];
+  uint8_t _sessionCount;
+#ifdef SPOTIFY_STATS
+  SpotifyRequestStats _stats;
+#endif
+  SpotifyResult _lastResult;
+  long _contentLength;
+  size_t _docPeak;
+  long _contentRangeStart;
+  long _rangeStart; // sends a Range header with the next GET if >= 0
+  bool _acceptGzip;  // sends an Accept-Encoding header with the next GET
+  bool _bodyChunked;
+  bool _bodyGzipped;
+  SpotifyChunkedStream _chunked;
+#ifdef SPOTIFY_GZIP
+  SpotifyInflateStream _inflate;
+#endif
+  Stream &bodyStream(Stream &raw);
+  long _readImageBody(Stream *file, long remaining, long skip);
   int getContentLength();
   int getHttpStatusCode();
-  void skipHeaders(bool tossUnexpectedForJSON = true);
+  bool skipHeaders(bool tossUnexpectedForJSON = true);
   void closeClient();
+  DeserializationError deserializeResponse(const JsonDocument *filter = NULL);
+  bool scanResponse(SpotifyJsonScanner &scanner);
+  void setTrackPath(const char *endpoint, const char *trackUri);
   void parseError();
-  void _initCurrentlyPlayingStruct();
+  void resetResult();
+  void setResultError(SpotifyErrorPhase phase);
+  void setParseError(DeserializationError error);
+  int sendApiRequest(const char *type, const char *body = "");
+  void sendControl(const char *type, const char *deviceId, const char *body = "");
+  int _fetchDevices(SpotifyDevice *devices, uint8_t size);
+#ifdef SPOTIFY_DEVICE_LIST
+  bool _refreshDevices();
+  const SpotifyDevice *_lookupDevice(const char *nameOrType);
+  SpotifyDevice _devices[SPOTIFY_MAX_DEVICES];
+  uint8_t _deviceCount;
+  bool _devicesValid;
+  unsigned long _devicesFetchedAt;
+#endif
+  void _initCurrentlyPlayingStruct(CurrentlyPlaying &playing);
   void _initDeviceStruct();
+  void _initSessions();
+  SpotifyQueuedAction _actions[SPOTIFY_ACTION_QUEUE_SIZE];
+  uint8_t _actionCount;
+  bool _runningActions;
+  SpotifyPollCallback _pollCallback;
+  SpotifyActionCallback _actionCallback;
+  void _initActions();
+  bool _shouldGiveWay();
+  static void _onAnalysisValue(SpotifyJsonScanner &scanner, SpotifyJsonType type, const char *value, void *context);
+  void _resetSnapshot(SpotifySnapshot &snapshot);
+  SpotifyChangeCallback _changeCallback;
+  uint8_t _changeMask;
+  void _parseCurrentlyPlaying(JsonObject root);
+  unsigned long _currentlyPlayingAt; // when currentlyPlaying was parsed
+#ifdef SPOTIFY_UP_NEXT
+  uint32_t _prefetchedFor;           // hash of the track prefetchNext() last ran for
+#endif
+  void _parsePlayerDetails(JsonObject root);
+  // Update the snapshot and return the spotify_changed_* flags
+  uint8_t _diffCurrentlyPlaying();
+  uint8_t _diffPlayerDetails();
+  void _notifyChanges(uint8_t changes);
   const char *requestAccessTokensBody =
       R"(grant_type=authorization_code&redirect_uri=%s&code=%s&client_id=%s&client_secret=%s)";
   const char *refreshAccessTokensBody =
@@ -0,0 +1,233 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "ArduinoSpotifyArt.h"
+
+#define SPOTIFY_ART_KMEANS_ROUNDS 8
+
+// Middle of a histogram bin in 8 bit per channel
+static int16_t binChannel(uint16_t bin, uint8_t shift)
+{
+    return (((bin >> shift) & 0x07) << 5) | 0x10;
+}
+
+static uint32_t colourDistance(int16_t r1, int16_t g1, int16_t b1, int16_t r2, int16_t g2, int16_t b2)
+{
+    int32_t dr = r1 - r2;
+    int32_t dg = g1 - g2;
+    int32_t db = b1 - b2;
+    return dr * dr + dg * dg + db * db;
+}
+
+SpotifyArtColours::SpotifyArtColours()
+{
+    memset(_cache, 0, sizeof(_cache));
+    _cacheNext = 0;
+    begin();
+}
+
+void SpotifyArtColours::begin()
+{
+    memset(_hist, 0, sizeof(_hist));
+    _pixels = 0;
+    _count = 0;
+}
+
+bool SpotifyArtColours::pushBlock(int16_t x, int16_t y, uint16_t w, uint16_t h, const uint16_t *bitmap)
+{
+    (void)x;
+    (void)y;
+    uint32_t n = (uint32_t)w * h;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint16_t c = bitmap[i];
+        // top 3 bits of each channel
+        uint16_t bin = ((c >> 13) << 6) | (((c >> 8) & 0x07) << 3) | ((c >> 2) & 0x07);
+        if (_hist[bin] < 0xFFFF)
+        {
+            _hist[bin]++;
+            _pixels++;
+        }
+    }
+    return true;
+}
+
+uint8_t SpotifyArtColours::end(uint8_t count, const char *imageUrl)
+{
+    _count = 0;
+    if (count > SPOTIFY_ART_MAX_COLOURS)
+    {
+        count = SPOTIFY_ART_MAX_COLOURS;
+    }
+    if (_pixels == 0 || count == 0)
+    {
+        return 0;
+    }
+
+    // Seed with the biggest bin, then keep adding the bin that is
+    // furthest from the colours so far (weighted by how full it is)
+    int16_t centres[SPOTIFY_ART_MAX_COLOURS][3];
+    uint8_t k = 0;
+    while (k < count)
+    {
+        uint16_t best = 0;
+        uint64_t bestScore = 0;
+        for (uint16_t bin = 0; bin < 512; bin++)
+        {
+            if (_hist[bin] == 0)
+            {
+                continue;
+            }
+            uint32_t nearest = 0xFFFFFFFF;
+            for (uint8_t c = 0; c < k; c++)
+            {
+                uint32_t d = colourDistance(binChannel(bin, 6), binChannel(bin, 3), binChannel(bin, 0), centres[c][0], centres[c][1], centres[c][2]);
+                if (d < nearest)
+                {
+                    nearest = d;
+                }
+            }
+            uint64_t score = (k == 0) ? _hist[bin] : (uint64_t)_hist[bin] * nearest;
+            if (score > bestScore)
+            {
+                bestScore = score;
+                best = bin;
+            }
+        }
+        if (bestScore == 0)
+        {
+            // fewer distinct colours than asked for
+            break;
+        }
+        centres[k][0] = binChannel(best, 6);
+        centres[k][1] = binChannel(best, 3);
+        centres[k][2] = binChannel(best, 0);
+        k++;
+    }
+
+    // k-means over the bins, each weighted by its pixel count
+    uint32_t sums[SPOTIFY_ART_MAX_COLOURS][4];
+    for (uint8_t round = 0; round < SPOTIFY_ART_KMEANS_ROUNDS; round++)
+    {
+        memset(sums, 0, sizeof(sums));
+        for (uint16_t bin = 0; bin < 512; bin++)
+        {
+            if (_hist[bin] == 0)
+            {
+                continue;
+            }
+            int16_t r = binChannel(bin, 6);
+            int16_t g = binChannel(bin, 3);
+            int16_t b = binChannel(bin, 0);
+            uint8_t nearest = 0;
+            uint32_t nearestDistance = 0xFFFFFFFF;
+            for (uint8_t c = 0; c < k; c++)
+            {
+                uint32_t d = colourDistance(r, g, b, centres[c][0], centres[c][1], centres[c][2]);
+                if (d < nearestDistance)
+                {
+                    nearestDistance = d;
+                    nearest = c;
+                }
+            }
+            sums[nearest][0] += (uint32_t)r * _hist[bin];
+            sums[nearest][1] += (uint32_t)g * _hist[bin];
+            sums[nearest][2] += (uint32_t)b * _hist[bin];
+            sums[nearest][3] += _hist[bin];
+        }
+
+        bool moved = false;
+        for (uint8_t c = 0; c < k; c++)
+        {
+            if (sums[c][3] == 0)
+            {
+                continue;
+            }
+            for (uint8_t channel = 0; channel < 3; channel++)
+            {
+                int16_t value = sums[c][channel] / sums[c][3];
+                moved |= (value != centres[c][channel]);
+                centres[c][channel] = value;
+            }
+        }
+        if (!moved)
+        {
+            break;
+        }
+    }
+
+    // Biggest share first, dropping any that ended up empty
+    for (uint8_t c = 0; c < k; c++)
+    {
+        if (sums[c][3] == 0)
+        {
+            continue;
+        }
+        SpotifyColour colour;
+        colour.r = centres[c][0];
+        colour.g = centres[c][1];
+        colour.b = centres[c][2];
+        colour.share = (sums[c][3] * 255 + _pixels / 2) / _pixels;
+
+        uint8_t j = _count;
+        while (j > 0 && _colours[j - 1].share < colour.share)
+        {
+            _colours[j] = _colours[j - 1];
+            j--;
+        }
+        _colours[j] = colour;
+        _count++;
+    }
+
+    if (imageUrl != NULL)
+    {
+        CacheEntry &entry = _cache[_cacheNext];
+        _cacheNext = (_cacheNext + 1) % SPOTIFY_ART_COLOUR_CACHE;
+        entry.key = spotifyHash(imageUrl);
+        entry.count = _count;
+        memcpy(entry.colours, _colours, sizeof(_colours));
+    }
+    return _count;
+}
+
+bool SpotifyArtColours::lookup(const char *imageUrl)
+{
+    uint32_t key = spotifyHash(imageUrl);
+    for (uint8_t i = 0; i < SPOTIFY_ART_COLOUR_CACHE; i++)
+    {
+        if (_cache[i].count > 0 && _cache[i].key == key)
+        {
+            _count = _cache[i].count;
+            memcpy(_colours, _cache[i].colours, sizeof(_colours));
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t SpotifyArtColours::count() const
+{
+    return _count;
+}
+
+const SpotifyColour &SpotifyArtColours::get(uint8_t index) const
+{
+    return _colours[(index < _count) ? index : 0];
+}
@@ -0,0 +1,478 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyArt_h
+#define ArduinoSpotifyArt_h
+
+#include <Arduino.h>
+#include "ArduinoSpotifyHash.h"
+
+// Most colours a SpotifyArtFrame palette can hold
+#ifndef SPOTIFY_ART_MAX_PALETTE
+#define SPOTIFY_ART_MAX_PALETTE 16
+#endif
+
+// Most colours SpotifyArtColours will look for
+#ifndef SPOTIFY_ART_MAX_COLOURS
+#define SPOTIFY_ART_MAX_COLOURS 4
+#endif
+
+// How many images SpotifyArtColours remembers the colours of
+#ifndef SPOTIFY_ART_COLOUR_CACHE
+#define SPOTIFY_ART_COLOUR_CACHE 4
+#endif
+
+// Picks the coarsest JPEG scale (8, 4, 2 or 1) that still decodes to at
+// least outWidth x outHeight, pass it to TJpgDec.setJpgScale().
+inline uint8_t spotifyArtJpegScale(uint16_t jpgWidth, uint16_t jpgHeight, uint16_t outWidth, uint16_t outHeight)
+{
+  for (uint8_t scale = 8; scale > 1; scale >>= 1)
+  {
+    if (jpgWidth / scale >= outWidth && jpgHeight / scale >= outHeight)
+    {
+      return scale;
+    }
+  }
+  return 1;
+}
+
+// Shrinks album art to a W x H RGB565 frame while the JPEG is decoding,
+// so the full size image never has to be in memory.
+//
+// The library doesn't decode JPEGs itself, pushBlock() takes the blocks
+// your decoder hands out (it matches the TJpg_Decoder callback). Every
+// decoded pixel is averaged into the output pixel it lands on (a box
+// filter), the frame can then be reduced to a small palette and saved,
+// so drawing the same art again is just loadFrom() and pixels().
+//
+// Uses 6 bytes of RAM per output pixel, e.g. 24KB for 64 x 64.
+template <uint16_t W, uint16_t H>
+class SpotifyArtFrame
+{
+public:
+  SpotifyArtFrame()
+  {
+    _srcWidth = 0;
+    _srcHeight = 0;
+    _paletteSize = 0;
+    _ready = false;
+    memset(_buf, 0, sizeof(_buf));
+  }
+
+  // Call before decoding with the size of the JPEG and the scale it will
+  // be decoded at. Returns false if the decoded image would be smaller
+  // than the frame or too big to average.
+  bool begin(uint16_t jpgWidth, uint16_t jpgHeight, uint8_t scale)
+  {
+    _srcWidth = jpgWidth / scale;
+    _srcHeight = jpgHeight / scale;
+    _paletteSize = 0;
+    _ready = false;
+    memset(_buf, 0, sizeof(_buf));
+
+    // The sums are 16 bit, so a pixel can average up to 1040 6 bit values
+    uint32_t perPixel = (uint32_t)((_srcWidth + W - 1) / W) * ((_srcHeight + H - 1) / H);
+    return _srcWidth >= W && _srcHeight >= H && perPixel <= 1040;
+  }
+
+  // Feed a decoded block of RGB565 pixels, always returns true so it can
+  // be returned straight from the decoder callback.
+  bool pushBlock(int16_t x, int16_t y, uint16_t w, uint16_t h, const uint16_t *bitmap)
+  {
+    if (_ready || _srcWidth == 0)
+    {
+      return true;
+    }
+
+    for (uint16_t row = 0; row < h; row++)
+    {
+      int32_t sy = y + row;
+      if (sy < 0 || sy >= _srcHeight)
+      {
+        continue;
+      }
+      uint32_t outRow = ((uint32_t)sy * H / _srcHeight) * W;
+      const uint16_t *in = bitmap + (uint32_t)row * w;
+
+      for (uint16_t col = 0; col < w; col++)
+      {
+        int32_t sx = x + col;
+        if (sx < 0 || sx >= _srcWidth)
+        {
+          continue;
+        }
+        uint16_t *sum = _buf + (outRow + (uint32_t)sx * W / _srcWidth) * 3;
+        uint16_t c = in[col];
+        sum[0] += (c >> 11) << 1; // red to 6 bits like green
+        sum[1] += (c >> 5) & 0x3F;
+        sum[2] += (c & 0x1F) << 1;
+      }
+    }
+    return true;
+  }
+
+  // Call once the decoder is done, turns the sums into pixels().
+  void end()
+  {
+    if (_ready || _srcWidth == 0)
+    {
+      return;
+    }
+
+    // The pixels are written over the front of the sums, pixel i only
+    // needs sums 3i to 3i+2 so going forwards never reads a pixel.
+    for (uint16_t oy = 0; oy < H; oy++)
+    {
+      uint16_t rows = span(oy, _srcHeight, H);
+      for (uint16_t ox = 0; ox < W; ox++)
+      {
+        uint32_t count = (uint32_t)rows * span(ox, _srcWidth, W);
+        uint32_t i = (uint32_t)oy * W + ox;
+        const uint16_t *sum = _buf + i * 3;
+        uint16_t r = (sum[0] / count) >> 1;
+        uint16_t g = sum[1] / count;
+        uint16_t b = (sum[2] / count) >> 1;
+        _buf[i] = (r << 11) | (g << 5) | b;
+      }
+    }
+    _ready = true;
+  }
+
+  // Maps every pixel to the closest colour of the given palette
+  bool quantize(const uint16_t *palette, uint8_t paletteSize)
+  {
+    if (!_ready || paletteSize == 0 || paletteSize > SPOTIFY_ART_MAX_PALETTE)
+    {
+      return false;
+    }
+
+    memcpy(_palette, palette, paletteSize * sizeof(uint16_t));
+    _paletteSize = paletteSize;
+    uint8_t *indices = this->indices();
+    for (uint32_t i = 0; i < (uint32_t)W * H; i++)
+    {
+      indices[i] = closest(_buf[i]);
+      _buf[i] = _palette[indices[i]];
+    }
+    return true;
+  }
+
+  // Builds a palette of the most used colours (on a 3-3-2 grid) and
+  // quantizes to it. Returns how many colours it ended up with.
+  uint8_t quantize(uint8_t paletteSize)
+  {
+    if (!_ready || paletteSize == 0)
+    {
+      return 0;
+    }
+    if (paletteSize > SPOTIFY_ART_MAX_PALETTE)
+    {
+      paletteSize = SPOTIFY_ART_MAX_PALETTE;
+    }
+
+    uint16_t hist[256];
+    memset(hist, 0, sizeof(hist));
+    for (uint32_t i = 0; i < (uint32_t)W * H; i++)
+    {
+      uint16_t c = _buf[i];
+      uint8_t bin = ((c >> 13) << 5) | (((c >> 8) & 0x07) << 2) | ((c >> 3) & 0x03);
+      if (hist[bin] < 0xFFFF)
+      {
+        hist[bin]++;
+      }
+    }
+
+    uint16_t palette[SPOTIFY_ART_MAX_PALETTE];
+    uint8_t found = 0;
+    while (found < paletteSize)
+    {
+      uint16_t best = 0;
+      for (uint16_t bin = 1; bin < 256; bin++)
+      {
+        if (hist[bin] > hist[best])
+        {
+          best = bin;
+        }
+      }
+      if (hist[best] == 0)
+      {
+        break;
+      }
+      hist[best] = 0;
+
+      // Middle of the bin
+      uint16_t r = ((best >> 5) << 2) | 0x02;
+      uint16_t g = (((best >> 2) & 0x07) << 3) | 0x04;
+      uint16_t b = ((best & 0x03) << 3) | 0x04;
+      palette[found++] = (r << 11) | (g << 5) | b;
+    }
+    if (found == 0)
+    {
+      return 0;
+    }
+
+    // Bin middles can be well off, move each colour to the average of
+    // the pixels closest to it
+    memcpy(_palette, palette, found * sizeof(uint16_t));
+    _paletteSize = found;
+    uint32_t sums[SPOTIFY_ART_MAX_PALETTE][4];
+    memset(sums, 0, sizeof(sums));
+    for (uint32_t i = 0; i < (uint32_t)W * H; i++)
+    {
+      uint16_t c = _buf[i];
+      uint32_t *sum = sums[closest(c)];
+      sum[0] += c >> 11;
+      sum[1] += (c >> 5) & 0x3F;
+      sum[2] += c & 0x1F;
+      sum[3]++;
+    }
+    for (uint8_t i = 0; i < found; i++)
+    {
+      if (sums[i][3] > 0)
+      {
+        palette[i] = ((sums[i][0] / sums[i][3]) << 11) | ((sums[i][1] / sums[i][3]) << 5) | (sums[i][2] / sums[i][3]);
+      }
+    }
+    return quantize(palette, found) ? found : 0;
+  }
+
+  // RGB565, W x H, ready for drawRGBBitmap()
+  const uint16_t *pixels() const
+  {
+    return _ready ? _buf : NULL;
+  }
+
+  // Palette index per pixel, only valid after quantize()
+  const uint8_t *paletteIndices() const
+  {
+    return (_ready && _paletteSize > 0) ? (const uint8_t *)(_buf + (uint32_t)W * H) : NULL;
+  }
+
+  const uint16_t *palette() const
+  {
+    return _palette;
+  }
+
+  uint8_t paletteSize() const
+  {
+    return _paletteSize;
+  }
+
+  bool ready() const
+  {
+    return _ready;
+  }
+
+  uint16_t width() const
+  {
+    return W;
+  }
+
+  uint16_t height() const
+  {
+    return H;
+  }
+
+  // Writes the frame to a file, with the palette and one byte per pixel
+  // if it has been quantized. The URL is stored as a key for loadFrom().
+  bool saveTo(Print &out, const char *imageUrl) const
+  {
+    if (!_ready)
+    {
+      return false;
+    }
+
+    Header header;
+    fillHeader(header, imageUrl);
+    size_t expected = sizeof(header);
+    size_t written = out.write((const uint8_t *)&header, sizeof(header));
+    if (_paletteSize > 0)
+    {
+      expected += _paletteSize * sizeof(uint16_t) + (size_t)W * H;
+      written += out.write((const uint8_t *)_palette, _paletteSize * sizeof(uint16_t));
+      written += out.write(paletteIndices(), (size_t)W * H);
+    }
+    else
+    {
+      expected += (size_t)W * H * sizeof(uint16_t);
+      written += out.write((const uint8_t *)_buf, (size_t)W * H * sizeof(uint16_t));
+    }
+    return written == expected;
+  }
+
+  // Loads a frame saved by saveTo(), returns false if it is for a
+  // different image or frame size.
+  bool loadFrom(Stream &in, const char *imageUrl)
+  {
+    Header expected;
+    Header header;
+    fillHeader(expected, imageUrl);
+    _ready = false;
+    if (in.readBytes((char *)&header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.width != W || header.height != H || header.key != expected.key ||
+        header.paletteSize > SPOTIFY_ART_MAX_PALETTE)
+    {
+      return false;
+    }
+
+    _paletteSize = header.paletteSize;
+    if (_paletteSize > 0)
+    {
+      uint8_t *indices = this->indices();
+      size_t paletteBytes = _paletteSize * sizeof(uint16_t);
+      if (in.readBytes((char *)_palette, paletteBytes) != paletteBytes ||
+          in.readBytes((char *)indices, (size_t)W * H) != (size_t)W * H)
+      {
+        return false;
+      }
+      for (uint32_t i = 0; i < (uint32_t)W * H; i++)
+      {
+        if (indices[i] >= _paletteSize)
+        {
+          return false;
+        }
+        _buf[i] = _palette[indices[i]];
+      }
+    }
+    else if (in.readBytes((char *)_buf, (size_t)W * H * sizeof(uint16_t)) != (size_t)W * H * sizeof(uint16_t))
+    {
+      return false;
+    }
+    _ready = true;
+    return true;
+  }
+
+private:
+  struct Header
+  {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+    uint8_t paletteSize;
+    uint8_t reserved[3];
+    uint32_t key;
+  };
+
+  void fillHeader(Header &header, const char *imageUrl) const
+  {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SPAF", 4);
+    header.width = W;
+    header.height = H;
+    header.paletteSize = _paletteSize;
+    header.key = spotifyHash(imageUrl);
+  }
+
+  // How many source pixels land on output pixel `out`
+  static uint16_t span(uint16_t out, uint16_t src, uint16_t dst)
+  {
+    uint32_t first = ((uint32_t)out * src + dst - 1) / dst;
+    uint32_t next = ((uint32_t)(out + 1) * src + dst - 1) / dst;
+    return next - first;
+  }
+
+  uint8_t closest(uint16_t c) const
+  {
+    int16_t r = (c >> 11) << 1;
+    int16_t g = (c >> 5) & 0x3F;
+    int16_t b = (c & 0x1F) << 1;
+    uint8_t best = 0;
+    uint32_t bestDistance = 0xFFFFFFFF;
+    for (uint8_t i = 0; i < _paletteSize; i++)
+    {
+      int16_t dr = r - ((_palette[i] >> 11) << 1);
+      int16_t dg = g - ((_palette[i] >> 5) & 0x3F);
+      int16_t db = b - ((_palette[i] & 0x1F) << 1);
+      uint32_t distance = dr * dr + dg * dg + db * db;
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        best = i;
+      }
+    }
+    return best;
+  }
+
+  // The indices live behind the pixels, in what were the sums
+  uint8_t *indices()
+  {
+    return (uint8_t *)(_buf + (uint32_t)W * H);
+  }
+
+  // 3 sums per pixel while decoding, then pixels followed by indices
+  uint16_t _buf[(uint32_t)W * H * 3];
+  uint16_t _palette[SPOTIFY_ART_MAX_PALETTE];
+  uint16_t _srcWidth;
+  uint16_t _srcHeight;
+  uint8_t _paletteSize;
+  bool _ready;
+};
+
+struct SpotifyColour
+{
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+  uint8_t share; // how much of the image is closest to it, 255 is all of it
+};
+
+// Works out the main colours of album art while the JPEG is decoding,
+// e.g. for driving LED strips. Like SpotifyArtFrame it is fed with
+// pushBlock() from the decoder callback, decode at scale 8 as a few
+// hundred pixels are plenty. It keeps a 512 bin (3 bits per channel)
+// histogram rather than the image, end() then clusters the bins with
+// k-means. The results of the last SPOTIFY_ART_COLOUR_CACHE images are
+// kept, check lookup() before downloading the art again.
+class SpotifyArtColours
+{
+public:
+  SpotifyArtColours();
+
+  // Call before decoding each image
+  void begin();
+  bool pushBlock(int16_t x, int16_t y, uint16_t w, uint16_t h, const uint16_t *bitmap);
+  // Finds up to `count` colours, sorted by share. Pass the image URL to
+  // cache them. Returns how many it found.
+  uint8_t end(uint8_t count = SPOTIFY_ART_MAX_COLOURS, const char *imageUrl = NULL);
+
+  // Loads the cached colours of an image, false if they aren't cached
+  bool lookup(const char *imageUrl);
+
+  uint8_t count() const;
+  const SpotifyColour &get(uint8_t index) const;
+
+private:
+  uint16_t _hist[512];
+  uint32_t _pixels;
+  SpotifyColour _colours[SPOTIFY_ART_MAX_COLOURS];
+  uint8_t _count;
+
+  struct CacheEntry
+  {
+    uint32_t key;
+    uint8_t count;
+    SpotifyColour colours[SPOTIFY_ART_MAX_COLOURS];
+  };
+  CacheEntry _cache[SPOTIFY_ART_COLOUR_CACHE];
+  uint8_t _cacheNext;
+};
+
+#endif
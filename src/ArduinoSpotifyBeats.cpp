@@ -0,0 +1,204 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "ArduinoSpotifyBeats.h"
+
+SpotifyBeatClock::SpotifyBeatClock()
+{
+    clear();
+}
+
+void SpotifyBeatClock::clear()
+{
+    _key = 0;
+    _beatCount = 0;
+    _barCount = 0;
+    _sectionCount = 0;
+    _progressMs = 0;
+    _syncedAt = millis();
+    _playing = false;
+}
+
+bool SpotifyBeatClock::load(Stream &in, const char *trackUri)
+{
+    clear();
+
+    char magic[4];
+    uint32_t key;
+    if (in.readBytes(magic, 4) != 4 || memcmp(magic, "SPBA", 4) != 0 ||
+        in.readBytes((char *)&key, 4) != 4 || key != spotifyHash(trackUri))
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        char tag = 0;
+        if (in.readBytes(&tag, 1) != 1)
+        {
+            break;
+        }
+        if (tag == spotify_analysis_end)
+        {
+            _key = key;
+            return true;
+        }
+
+        uint32_t *starts;
+        uint16_t *count;
+        uint16_t capacity;
+        switch (tag)
+        {
+        case spotify_analysis_beats:
+            starts = _beats;
+            count = &_beatCount;
+            capacity = SPOTIFY_BEAT_CLOCK_BEATS;
+            break;
+        case spotify_analysis_bars:
+            starts = _bars;
+            count = &_barCount;
+            capacity = SPOTIFY_BEAT_CLOCK_BARS;
+            break;
+        case spotify_analysis_sections:
+            starts = _sections;
+            count = &_sectionCount;
+            capacity = SPOTIFY_BEAT_CLOCK_SECTIONS;
+            break;
+        default:
+            clear();
+            return false;
+        }
+
+        uint32_t start;
+        while (in.readBytes((char *)&start, 4) == 4 && start != SPOTIFY_ANALYSIS_LIST_END)
+        {
+            if (*count < capacity)
+            {
+                starts[(*count)++] = start;
+            }
+        }
+    }
+
+    // Ran out before the end tag
+    clear();
+    return false;
+}
+
+bool SpotifyBeatClock::isFor(const char *trackUri) const
+{
+    return _key != 0 && _key == spotifyHash(trackUri);
+}
+
+void SpotifyBeatClock::sync(long progressMs, bool isPlaying)
+{
+    _progressMs = progressMs;
+    _syncedAt = millis();
+    _playing = isPlaying;
+}
+
+long SpotifyBeatClock::position() const
+{
+    if (!_playing)
+    {
+        return _progressMs;
+    }
+    return _progressMs + (long)(millis() - _syncedAt);
+}
+
+// Last entry starting at or before the position
+int SpotifyBeatClock::find(const uint32_t *starts, uint16_t count, long position)
+{
+    if (position < 0)
+    {
+        return -1;
+    }
+    int low = 0;
+    int high = count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (starts[mid] <= (uint32_t)position)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low - 1;
+}
+
+int SpotifyBeatClock::beat() const
+{
+    return find(_beats, _beatCount, position());
+}
+
+int SpotifyBeatClock::bar() const
+{
+    return find(_bars, _barCount, position());
+}
+
+int SpotifyBeatClock::section() const
+{
+    return find(_sections, _sectionCount, position());
+}
+
+uint8_t SpotifyBeatClock::beatPhase() const
+{
+    long now = position();
+    int current = find(_beats, _beatCount, now);
+    if (current < 0 || current + 1 >= _beatCount)
+    {
+        return 0;
+    }
+    uint32_t length = _beats[current + 1] - _beats[current];
+    if (length == 0)
+    {
+        return 0;
+    }
+    return ((uint32_t)now - _beats[current]) * 256 / length;
+}
+
+long SpotifyBeatClock::msToNextBeat() const
+{
+    long now = position();
+    int next = find(_beats, _beatCount, now) + 1;
+    if (next >= _beatCount)
+    {
+        return -1;
+    }
+    return (long)_beats[next] - now;
+}
+
+uint16_t SpotifyBeatClock::beatCount() const
+{
+    return _beatCount;
+}
+
+uint16_t SpotifyBeatClock::barCount() const
+{
+    return _barCount;
+}
+
+uint16_t SpotifyBeatClock::sectionCount() const
+{
+    return _sectionCount;
+}
@@ -0,0 +1,103 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyBeats_h
+#define ArduinoSpotifyBeats_h
+
+#include <Arduino.h>
+#include "ArduinoSpotifyHash.h"
+
+// How many of each a SpotifyBeatClock can hold, anything past these is
+// ignored. 1024 beats is over 8 minutes at 120bpm.
+#ifndef SPOTIFY_BEAT_CLOCK_BEATS
+#define SPOTIFY_BEAT_CLOCK_BEATS 1024
+#endif
+#ifndef SPOTIFY_BEAT_CLOCK_BARS
+#define SPOTIFY_BEAT_CLOCK_BARS 256
+#endif
+#ifndef SPOTIFY_BEAT_CLOCK_SECTIONS
+#define SPOTIFY_BEAT_CLOCK_SECTIONS 32
+#endif
+
+// The lists in an analysis file, written by getAudioAnalysis():
+//   "SPBA", uint32 key (spotifyHash() of the track URI)
+//   for each list: tag, uint32 start in ms..., 0xFFFFFFFF
+//   0 tag at the end
+// Values are little endian, it's meant to be read back on the same board.
+enum SpotifyAnalysisList
+{
+  spotify_analysis_end = 0,
+  spotify_analysis_bars = 'B',
+  spotify_analysis_beats = 'b',
+  spotify_analysis_sections = 's'
+};
+
+#define SPOTIFY_ANALYSIS_LIST_END 0xFFFFFFFFUL
+
+// Tracks where playback is in a song's beats, bars and sections. Load
+// the file getAudioAnalysis() saved for the track, then sync() it with
+// the progress from getCurrentlyPlaying() whenever you poll, in between
+// the position is extrapolated with millis().
+class SpotifyBeatClock
+{
+public:
+  SpotifyBeatClock();
+
+  // False if the file is for a different track or isn't valid
+  bool load(Stream &in, const char *trackUri);
+  bool isFor(const char *trackUri) const;
+  void clear();
+
+  void sync(long progressMs, bool isPlaying);
+
+  // Extrapolated playback position in ms
+  long position() const;
+
+  // Index of the current beat/bar/section, -1 before the first one
+  int beat() const;
+  int bar() const;
+  int section() const;
+
+  // How far through the current beat, 0 at the beat to 255 just before
+  // the next one
+  uint8_t beatPhase() const;
+  // -1 if there are no more beats
+  long msToNextBeat() const;
+
+  uint16_t beatCount() const;
+  uint16_t barCount() const;
+  uint16_t sectionCount() const;
+
+private:
+  static int find(const uint32_t *starts, uint16_t count, long position);
+
+  uint32_t _key;
+  uint32_t _beats[SPOTIFY_BEAT_CLOCK_BEATS];
+  uint32_t _bars[SPOTIFY_BEAT_CLOCK_BARS];
+  uint32_t _sections[SPOTIFY_BEAT_CLOCK_SECTIONS];
+  uint16_t _beatCount;
+  uint16_t _barCount;
+  uint16_t _sectionCount;
+  long _progressMs;
+  unsigned long _syncedAt;
+  bool _playing;
+};
+
+#endif
@@ -0,0 +1,722 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "ArduinoSpotifyDecode.h"
+
+#if (SPOTIFY_INFLATE_WINDOW & (SPOTIFY_INFLATE_WINDOW - 1)) != 0
+#error SPOTIFY_INFLATE_WINDOW must be a power of two
+#endif
+
+#define SPOTIFY_WINDOW_MASK (SPOTIFY_INFLATE_WINDOW - 1)
+
+// Both streams block in read() on the source's timeout, so their own
+// timeout is 0 to make readBytes() on them try just once.
+
+SpotifyChunkedStream::SpotifyChunkedStream()
+{
+    _source = NULL;
+    _finished = true;
+    _remaining = 0;
+    _peeked = -1;
+    setTimeout(0);
+}
+
+void SpotifyChunkedStream::begin(Stream &source)
+{
+    _source = &source;
+    _finished = false;
+    _remaining = 0;
+    _peeked = -1;
+}
+
+// Reads the size line of the next chunk, a 0 size is the last one
+bool SpotifyChunkedStream::startChunk()
+{
+    char line[16];
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        size_t length = _source->readBytesUntil('\n', line, sizeof(line) - 1);
+        if (length == 0)
+        {
+            // timed out
+            break;
+        }
+        line[length] = 0;
+        if (length == sizeof(line) - 1)
+        {
+            // Chunk extensions, we don't use them
+            _source->find("\n");
+        }
+        if (line[0] == '\r')
+        {
+            // The line break after the previous chunk's data
+            continue;
+        }
+
+        _remaining = strtoul(line, NULL, 16);
+        _finished = (_remaining == 0);
+        return !_finished;
+    }
+    _finished = true;
+    return false;
+}
+
+int SpotifyChunkedStream::nextByte()
+{
+    if (_finished || _source == NULL)
+    {
+        return -1;
+    }
+    if (_remaining == 0 && !startChunk())
+    {
+        return -1;
+    }
+
+    char c;
+    if (_source->readBytes(&c, 1) != 1)
+    {
+        _finished = true;
+        return -1;
+    }
+    _remaining--;
+    return (uint8_t)c;
+}
+
+int SpotifyChunkedStream::available()
+{
+    if (_peeked >= 0)
+    {
+        return 1;
+    }
+    if (_finished || _source == NULL)
+    {
+        return 0;
+    }
+    int waiting = _source->available();
+    if (_remaining > 0 && (unsigned long)waiting > _remaining)
+    {
+        return _remaining;
+    }
+    return waiting;
+}
+
+int SpotifyChunkedStream::read()
+{
+    if (_peeked >= 0)
+    {
+        int c = _peeked;
+        _peeked = -1;
+        return c;
+    }
+    return nextByte();
+}
+
+int SpotifyChunkedStream::peek()
+{
+    if (_peeked < 0)
+    {
+        _peeked = nextByte();
+    }
+    return _peeked;
+}
+
+size_t SpotifyChunkedStream::write(uint8_t c)
+{
+    (void)c;
+    return 0;
+}
+
+bool SpotifyChunkedStream::finished() const
+{
+    return _finished;
+}
+
+// Inflate is based on puff.c by Mark Adler, decoding a bit at a time is
+// slower than zlib's tables but needs a fraction of the memory, and the
+// responses are small.
+
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// CRC-32 a nibble at a time
+static const uint32_t crcTable[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+SpotifyInflateStream::SpotifyInflateStream()
+{
+    _lengthCode.count = _lengthCount;
+    _lengthCode.symbol = _lengthSymbol;
+    _distanceCode.count = _distanceCount;
+    _distanceCode.symbol = _distanceSymbol;
+    _source = NULL;
+    _state = state_done;
+    _peeked = -1;
+    setTimeout(0);
+}
+
+void SpotifyInflateStream::begin(Stream &source)
+{
+    _source = &source;
+    _state = state_header;
+    _lastBlock = false;
+    _bitBuffer = 0;
+    _bitCount = 0;
+    _storedRemaining = 0;
+    _copyRemaining = 0;
+    _copyDistance = 0;
+    _peeked = -1;
+    _position = 0;
+    _crc = 0xFFFFFFFF;
+    _compressed = 0;
+}
+
+int SpotifyInflateStream::fail()
+{
+    _state = state_failed;
+    return -1;
+}
+
+int SpotifyInflateStream::sourceByte()
+{
+    char c;
+    if (_source == NULL || _source->readBytes(&c, 1) != 1)
+    {
+        return -1;
+    }
+    _compressed++;
+    return (uint8_t)c;
+}
+
+// Running out of input marks the stream as failed and returns 0, so
+// callers only have to check the state once they are done
+int SpotifyInflateStream::bits(uint8_t need)
+{
+    while (_bitCount < need)
+    {
+        int c = sourceByte();
+        if (c < 0)
+        {
+            _state = state_failed;
+            return 0;
+        }
+        _bitBuffer |= (uint32_t)c << _bitCount;
+        _bitCount += 8;
+    }
+    int value = _bitBuffer & ((1UL << need) - 1);
+    _bitBuffer >>= need;
+    _bitCount -= need;
+    return value;
+}
+
+int SpotifyInflateStream::decode(const Huffman &h)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (uint8_t length = 1; length < 16; length++)
+    {
+        code |= bits(1);
+        if (_state == state_failed)
+        {
+            return -1;
+        }
+        int count = h.count[length];
+        if (code - count < first)
+        {
+            return h.symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Canonical Huffman code from the code lengths, returns 0 for a complete
+// code, > 0 if it's incomplete and < 0 if it's over-subscribed
+int SpotifyInflateStream::build(Huffman &h, const uint8_t *lengths, int n)
+{
+    for (uint8_t length = 0; length < 16; length++)
+    {
+        h.count[length] = 0;
+    }
+    for (int symbol = 0; symbol < n; symbol++)
+    {
+        h.count[lengths[symbol]]++;
+    }
+    if (h.count[0] == n)
+    {
+        return 0;
+    }
+
+    int left = 1;
+    for (uint8_t length = 1; length < 16; length++)
+    {
+        left <<= 1;
+        left -= h.count[length];
+        if (left < 0)
+        {
+            return left;
+        }
+    }
+
+    int16_t offsets[16];
+    offsets[1] = 0;
+    for (uint8_t length = 1; length < 15; length++)
+    {
+        offsets[length + 1] = offsets[length] + h.count[length];
+    }
+    for (int symbol = 0; symbol < n; symbol++)
+    {
+        if (lengths[symbol] != 0)
+        {
+            h.symbol[offsets[lengths[symbol]]++] = symbol;
+        }
+    }
+    return left;
+}
+
+bool SpotifyInflateStream::fixedCodes()
+{
+    uint8_t lengths[288];
+    uint16_t symbol = 0;
+    for (; symbol < 144; symbol++)
+    {
+        lengths[symbol] = 8;
+    }
+    for (; symbol < 256; symbol++)
+    {
+        lengths[symbol] = 9;
+    }
+    for (; symbol < 280; symbol++)
+    {
+        lengths[symbol] = 7;
+    }
+    for (; symbol < 288; symbol++)
+    {
+        lengths[symbol] = 8;
+    }
+    build(_lengthCode, lengths, 288);
+
+    for (symbol = 0; symbol < 30; symbol++)
+    {
+        lengths[symbol] = 5;
+    }
+    build(_distanceCode, lengths, 30);
+    return true;
+}
+
+bool SpotifyInflateStream::dynamicCodes()
+{
+    int lengthCodes = bits(5) + 257;
+    int distanceCodes = bits(5) + 1;
+    int codeLengthCodes = bits(4) + 4;
+    if (_state == state_failed || lengthCodes > 286 || distanceCodes > 30)
+    {
+        return false;
+    }
+
+    // The code lengths are themselves Huffman coded
+    uint8_t lengths[286 + 30];
+    int index;
+    for (index = 0; index < codeLengthCodes; index++)
+    {
+        lengths[codeLengthOrder[index]] = bits(3);
+    }
+    for (; index < 19; index++)
+    {
+        lengths[codeLengthOrder[index]] = 0;
+    }
+    if (_state == state_failed || build(_lengthCode, lengths, 19) != 0)
+    {
+        return false;
+    }
+
+    index = 0;
+    while (index < lengthCodes + distanceCodes)
+    {
+        int symbol = decode(_lengthCode);
+        if (symbol < 0)
+        {
+            return false;
+        }
+        if (symbol < 16)
+        {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        uint8_t repeated = 0;
+        if (symbol == 16)
+        {
+            if (index == 0)
+            {
+                return false;
+            }
+            repeated = lengths[index - 1];
+            symbol = 3 + bits(2);
+        }
+        else if (symbol == 17)
+        {
+            symbol = 3 + bits(3);
+        }
+        else
+        {
+            symbol = 11 + bits(7);
+        }
+        if (_state == state_failed || index + symbol > lengthCodes + distanceCodes)
+        {
+            return false;
+        }
+        while (symbol--)
+        {
+            lengths[index++] = repeated;
+        }
+    }
+
+    // There has to be an end of block code
+    if (lengths[256] == 0)
+    {
+        return false;
+    }
+
+    // Incomplete codes are only allowed when there is a single code
+    int error = build(_lengthCode, lengths, lengthCodes);
+    if (error < 0 || (error > 0 && lengthCodes - _lengthCount[0] != 1))
+    {
+        return false;
+    }
+    error = build(_distanceCode, lengths + lengthCodes, distanceCodes);
+    if (error < 0 || (error > 0 && distanceCodes - _distanceCount[0] != 1))
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SpotifyInflateStream::readHeader()
+{
+    uint8_t header[10];
+    for (uint8_t i = 0; i < sizeof(header); i++)
+    {
+        int c = sourceByte();
+        if (c < 0)
+        {
+            return false;
+        }
+        header[i] = c;
+    }
+    // magic and deflate
+    if (header[0] != 0x1F || header[1] != 0x8B || header[2] != 8)
+    {
+        return false;
+    }
+
+    uint8_t flags = header[3];
+    if (flags & 0x04)
+    {
+        // extra field
+        int low = sourceByte();
+        int high = sourceByte();
+        if (low < 0 || high < 0)
+        {
+            return false;
+        }
+        for (uint16_t extra = low | (high << 8); extra > 0; extra--)
+        {
+            if (sourceByte() < 0)
+            {
+                return false;
+            }
+        }
+    }
+    // file name then comment, both zero terminated
+    for (uint8_t flag = 0x08; flag <= 0x10; flag <<= 1)
+    {
+        if (flags & flag)
+        {
+            int c;
+            do
+            {
+                c = sourceByte();
+            } while (c > 0);
+            if (c < 0)
+            {
+                return false;
+            }
+        }
+    }
+    if (flags & 0x02)
+    {
+        // header CRC
+        if (sourceByte() < 0 || sourceByte() < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SpotifyInflateStream::readTrailer()
+{
+    // What's left of the last byte is padding
+    _bitBuffer = 0;
+    _bitCount = 0;
+
+    uint32_t values[2] = {0, 0};
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        int c = sourceByte();
+        if (c < 0)
+        {
+            return false;
+        }
+        values[i / 4] |= (uint32_t)c << (8 * (i % 4));
+    }
+    return values[0] == (_crc ^ 0xFFFFFFFF) && values[1] == _position;
+}
+
+int SpotifyInflateStream::output(uint8_t c)
+{
+    _window[_position & SPOTIFY_WINDOW_MASK] = c;
+    _position++;
+    _crc = (_crc >> 4) ^ crcTable[(_crc ^ c) & 0x0F];
+    _crc = (_crc >> 4) ^ crcTable[(_crc ^ (c >> 4)) & 0x0F];
+    return c;
+}
+
+// Next byte of output, -1 at the end or on an error
+int SpotifyInflateStream::produce()
+{
+    while (true)
+    {
+        switch (_state)
+        {
+        case state_header:
+            if (!readHeader())
+            {
+                return fail();
+            }
+            _state = state_block;
+            break;
+
+        case state_block:
+        {
+            if (_lastBlock)
+            {
+                _state = state_trailer;
+                break;
+            }
+            _lastBlock = bits(1);
+            int type = bits(2);
+            if (_state == state_failed)
+            {
+                return -1;
+            }
+
+            if (type == 0)
+            {
+                // Stored, starts on a byte boundary
+                _bitBuffer = 0;
+                _bitCount = 0;
+                int bytes[4];
+                for (uint8_t i = 0; i < 4; i++)
+                {
+                    bytes[i] = sourceByte();
+                    if (bytes[i] < 0)
+                    {
+                        return fail();
+                    }
+                }
+                uint16_t length = bytes[0] | (bytes[1] << 8);
+                uint16_t check = bytes[2] | (bytes[3] << 8);
+                if (length != (uint16_t)~check)
+                {
+                    return fail();
+                }
+                _storedRemaining = length;
+                _state = state_stored;
+            }
+            else if (type == 1)
+            {
+                fixedCodes();
+                _state = state_codes;
+            }
+            else if (type == 2 && dynamicCodes())
+            {
+                _state = state_codes;
+            }
+            else
+            {
+                return fail();
+            }
+            break;
+        }
+
+        case state_stored:
+        {
+            if (_storedRemaining == 0)
+            {
+                _state = state_block;
+                break;
+            }
+            int c = sourceByte();
+            if (c < 0)
+            {
+                return fail();
+            }
+            _storedRemaining--;
+            return output(c);
+        }
+
+        case state_codes:
+        {
+            if (_copyRemaining > 0)
+            {
+                _copyRemaining--;
+                return output(_window[(_position - _copyDistance) & SPOTIFY_WINDOW_MASK]);
+            }
+
+            int symbol = decode(_lengthCode);
+            if (symbol < 0)
+            {
+                return fail();
+            }
+            if (symbol < 256)
+            {
+                return output(symbol);
+            }
+            if (symbol == 256)
+            {
+                _state = state_block;
+                break;
+            }
+
+            symbol -= 257;
+            if (symbol >= 29)
+            {
+                return fail();
+            }
+            uint16_t length = lengthBase[symbol] + bits(lengthExtra[symbol]);
+            symbol = decode(_distanceCode);
+            if (symbol < 0 || symbol >= 30)
+            {
+                return fail();
+            }
+            uint32_t distance = distanceBase[symbol] + bits(distanceExtra[symbol]);
+            // Further back than we keep, SPOTIFY_INFLATE_WINDOW is too small
+            if (_state == state_failed || distance > _position || distance > SPOTIFY_INFLATE_WINDOW)
+            {
+                return fail();
+            }
+            _copyRemaining = length;
+            _copyDistance = distance;
+            break;
+        }
+
+        case state_trailer:
+            if (!readTrailer())
+            {
+                return fail();
+            }
+            _state = state_done;
+            return -1;
+
+        default:
+            return -1;
+        }
+    }
+}
+
+int SpotifyInflateStream::available()
+{
+    if (_peeked >= 0)
+    {
+        return 1;
+    }
+    if (_state == state_done || _state == state_failed)
+    {
+        return 0;
+    }
+    return (_copyRemaining > 0) ? _copyRemaining : 1;
+}
+
+int SpotifyInflateStream::read()
+{
+    if (_peeked >= 0)
+    {
+        int c = _peeked;
+        _peeked = -1;
+        return c;
+    }
+    return produce();
+}
+
+int SpotifyInflateStream::peek()
+{
+    if (_peeked < 0)
+    {
+        _peeked = produce();
+    }
+    return _peeked;
+}
+
+size_t SpotifyInflateStream::write(uint8_t c)
+{
+    (void)c;
+    return 0;
+}
+
+bool SpotifyInflateStream::finished() const
+{
+    return _state == state_done;
+}
+
+bool SpotifyInflateStream::failed() const
+{
+    return _state == state_failed;
+}
+
+unsigned long SpotifyInflateStream::compressedBytes() const
+{
+    return _compressed;
+}
+
+unsigned long SpotifyInflateStream::inflatedBytes() const
+{
+    return _position;
+}
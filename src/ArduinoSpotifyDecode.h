@@ -0,0 +1,135 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyDecode_h
+#define ArduinoSpotifyDecode_h
+
+#include <Arduino.h>
+
+// Streams that sit between the client and the JSON parsing and undo the
+// transfer and content encodings of a response body.
+
+// Bytes of output SpotifyInflateStream keeps for back references, must
+// be a power of two. Deflate can refer back up to 32KB, so that's what
+// it takes to inflate any response. It never refers back further than
+// the start of the body, so a smaller window is only safe if every
+// response is smaller than it, the player ones are already over 8KB.
+#ifndef SPOTIFY_INFLATE_WINDOW
+#define SPOTIFY_INFLATE_WINDOW 32768
+#endif
+
+// Removes the chunk framing of a "Transfer-Encoding: chunked" body
+class SpotifyChunkedStream : public Stream
+{
+public:
+  SpotifyChunkedStream();
+  void begin(Stream &source);
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+
+  bool finished() const;
+
+private:
+  int nextByte();
+  bool startChunk();
+
+  Stream *_source;
+  unsigned long _remaining;
+  int _peeked;
+  bool _finished;
+};
+
+// Inflates a "Content-Encoding: gzip" body as it is read, using a fixed
+// window of SPOTIFY_INFLATE_WINDOW bytes plus about 700 bytes of tables.
+// The CRC and length in the gzip trailer are checked once the end is read.
+class SpotifyInflateStream : public Stream
+{
+public:
+  SpotifyInflateStream();
+  void begin(Stream &source);
+
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+
+  bool finished() const;
+  bool failed() const;
+  // How many compressed bytes were read, and how many they came to
+  unsigned long compressedBytes() const;
+  unsigned long inflatedBytes() const;
+
+private:
+  struct Huffman
+  {
+    int16_t *count;
+    int16_t *symbol;
+  };
+
+  enum State
+  {
+    state_header,
+    state_block,
+    state_stored,
+    state_codes,
+    state_trailer,
+    state_done,
+    state_failed
+  };
+
+  int produce();
+  int output(uint8_t c);
+  int sourceByte();
+  int bits(uint8_t need);
+  int decode(const Huffman &h);
+  bool readHeader();
+  bool readTrailer();
+  bool fixedCodes();
+  bool dynamicCodes();
+  static int build(Huffman &h, const uint8_t *lengths, int n);
+  int fail();
+
+  Stream *_source;
+  State _state;
+  bool _lastBlock;
+  uint32_t _bitBuffer;
+  uint8_t _bitCount;
+  unsigned long _storedRemaining;
+  uint16_t _copyRemaining;
+  uint16_t _copyDistance;
+  int _peeked;
+
+  int16_t _lengthCount[16];
+  int16_t _lengthSymbol[288];
+  int16_t _distanceCount[16];
+  int16_t _distanceSymbol[30];
+  Huffman _lengthCode;
+  Huffman _distanceCode;
+
+  uint8_t _window[SPOTIFY_INFLATE_WINDOW];
+  uint32_t _position; // total bytes out, the window index is this mod the size
+  uint32_t _crc;
+  unsigned long _compressed;
+};
+
+#endif
@@ -0,0 +1,551 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "ArduinoSpotifyGateway.h"
+
+// Where the fixed part of the header ends up
+#define GATEWAY_SEQUENCE_OFFSET 6
+#define GATEWAY_HASH_OFFSET 10
+
+enum
+{
+    gateway_has_currently_playing = 0x01,
+    gateway_has_player_details = 0x02
+};
+
+// Bounds checked writing and reading of the packets
+struct SpotifyPacketWriter
+{
+    uint8_t *data;
+    size_t size;
+    size_t length;
+    bool overflow;
+
+    // A NULL data only measures
+    void u8(uint8_t value)
+    {
+        if (length < size)
+        {
+            if (data != NULL)
+            {
+                data[length] = value;
+            }
+            length++;
+        }
+        else
+        {
+            overflow = true;
+        }
+    }
+
+    void u32(uint32_t value)
+    {
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            u8(value >> (8 * i));
+        }
+    }
+
+    void str(const char *value)
+    {
+        size_t n = strlen(value);
+        if (n > 255)
+        {
+            n = 255;
+        }
+        u8(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            u8(value[i]);
+        }
+    }
+};
+
+struct SpotifyPacketReader
+{
+    const uint8_t *data;
+    size_t length;
+    size_t position;
+    bool overflow;
+
+    uint8_t u8()
+    {
+        if (position < length)
+        {
+            return data[position++];
+        }
+        overflow = true;
+        return 0;
+    }
+
+    uint32_t u32()
+    {
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            value |= (uint32_t)u8() << (8 * i);
+        }
+        return value;
+    }
+
+    // A NULL dest skips the string
+    void str(char *dest, size_t size)
+    {
+        uint8_t n = u8();
+        for (uint8_t i = 0; i < n; i++)
+        {
+            char c = u8();
+            if (dest != NULL && i < size - 1)
+            {
+                dest[i] = c;
+            }
+        }
+        if (dest != NULL)
+        {
+            dest[(n < size - 1) ? n : size - 1] = 0;
+        }
+    }
+};
+
+static void putU32(uint8_t *at, uint32_t value)
+{
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        at[i] = value >> (8 * i);
+    }
+}
+
+// FNV-1a of the packet, with the bytes that change every time (sequence,
+// hash and progress) left out
+static uint32_t packetHash(const uint8_t *packet, size_t length, const size_t *progressOffsets)
+{
+    uint32_t hash = 2166136261UL;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (i >= GATEWAY_SEQUENCE_OFFSET && i < GATEWAY_HASH_OFFSET + 4)
+        {
+            continue;
+        }
+        bool progress = false;
+        for (uint8_t p = 0; p < 2; p++)
+        {
+            if (progressOffsets[p] != 0 && i >= progressOffsets[p] && i < progressOffsets[p] + 4)
+            {
+                progress = true;
+            }
+        }
+        if (progress)
+        {
+            continue;
+        }
+        hash ^= packet[i];
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+SpotifyGateway::SpotifyGateway(ArduinoSpotify &spotify, UDP &udp, IPAddress destination, uint16_t port)
+    : _spotify(spotify), _udp(udp), _destination(destination), _port(port)
+{
+    packetsSent = 0;
+    polls = 0;
+    _length = 0;
+    _sequence = 0;
+    _artKey = 0;
+    _progressMs = 0;
+    _playing = false;
+    _snapshotAt = 0;
+    _polledAt = 0;
+    _publishedAt = 0;
+}
+
+bool SpotifyGateway::loop(unsigned long pollMs)
+{
+    bool changed = false;
+    if (polls == 0 || millis() - _polledAt >= pollMs)
+    {
+        _polledAt = millis();
+        polls++;
+
+        // A failed poll leaves the structs empty, so the last good
+        // snapshot keeps going out instead
+        if (_spotify.getPlayerState())
+        {
+            uint32_t before = (_length > 0) ? packetHash(_packet, _length, _progressOffsets) : 0;
+            if (encode() && packetHash(_packet, _length, _progressOffsets) != before)
+            {
+                publish();
+                changed = true;
+            }
+        }
+    }
+
+    if (_length > 0 && millis() - _publishedAt >= SPOTIFY_GATEWAY_REPEAT_MS)
+    {
+        publish();
+    }
+    return changed;
+}
+
+bool SpotifyGateway::encode()
+{
+    CurrentlyPlaying &playing = _spotify.currentlyPlaying;
+    PlayerDetails &player = _spotify.playerDetails;
+
+    // Can't overflow with the default sizes, but bigger strings could
+    // and half a snapshot is no use to anyone. Measure first so the last
+    // good one is still there to send if it doesn't fit.
+    size_t offsets[2];
+    SpotifyPacketWriter measure = {NULL, sizeof(_packet), 0, false};
+    writeSnapshot(measure, offsets);
+    if (measure.overflow)
+    {
+#ifdef SPOTIFY_DEBUG
+        Serial.println(F("Snapshot too big for the packet, keeping the last one"));
+#endif
+        return false;
+    }
+
+    SpotifyPacketWriter w = {_packet, sizeof(_packet), 0, false};
+    writeSnapshot(w, _progressOffsets);
+    _length = w.length;
+    _artKey = playing.error ? 0 : spotifyHash(playing.imgUrl);
+    putU32(_packet + GATEWAY_HASH_OFFSET, packetHash(_packet, _length, _progressOffsets));
+
+    // Both come from the same response so they have the same progress
+    _progressMs = playing.error ? player.progressMs : playing.progressMs;
+    _playing = playing.error ? player.isPlaying : playing.isPlaying;
+    _snapshotAt = millis();
+    return true;
+}
+
+void SpotifyGateway::writeSnapshot(SpotifyPacketWriter &w, size_t *progressOffsets)
+{
+    CurrentlyPlaying &playing = _spotify.currentlyPlaying;
+    PlayerDetails &player = _spotify.playerDetails;
+
+    w.u8('S');
+    w.u8('P');
+    w.u8('G');
+    w.u8('W');
+    w.u8(SPOTIFY_GATEWAY_VERSION);
+    w.u8((playing.error ? 0 : gateway_has_currently_playing) | (player.error ? 0 : gateway_has_player_details));
+    w.u32(0); // sequence, set by publish()
+    w.u32(0); // hash, set by encode()
+    w.u32(playing.error ? 0 : spotifyHash(playing.imgUrl));
+
+    progressOffsets[0] = 0;
+    progressOffsets[1] = 0;
+    if (!playing.error)
+    {
+        w.u8(playing.type);
+        w.u8(playing.isPlaying);
+        progressOffsets[0] = w.length;
+        w.u32(playing.progressMs);
+        w.u32(playing.duraitonMs);
+        w.str(playing.trackName);
+        w.str(playing.trackUri);
+        w.str(playing.firstArtistName);
+#ifndef SPOTIFY_NO_URIS
+        w.str(playing.firstArtistUri);
+#else
+        w.str("");
+#endif
+#ifndef SPOTIFY_NO_ALBUM_NAME
+        w.str(playing.albumName);
+#else
+        w.str("");
+#endif
+#ifndef SPOTIFY_NO_URIS
+        w.str(playing.albumUri);
+#else
+        w.str("");
+#endif
+        w.str(playing.imgUrl);
+    }
+    if (!player.error)
+    {
+        w.u8(player.isPlaying);
+        w.u8(player.repeateState);
+        w.u8(player.shuffleState);
+        progressOffsets[1] = w.length;
+        w.u32(player.progressMs);
+        w.str(player.device.id);
+        w.str(player.device.name);
+        w.str(player.device.type);
+        w.u8(player.device.isActive);
+        w.u8(player.device.isRestricted);
+        w.u8(player.device.isPrivateSession);
+        w.u8(player.device.volumePercent);
+    }
+}
+
+void SpotifyGateway::publish()
+{
+    if (_length == 0)
+    {
+        return;
+    }
+
+    // The progress it would be at by now
+    long progress = _progressMs;
+    if (_playing)
+    {
+        progress += millis() - _snapshotAt;
+    }
+
+    _sequence++;
+    putU32(_packet + GATEWAY_SEQUENCE_OFFSET, _sequence);
+    for (uint8_t p = 0; p < 2; p++)
+    {
+        if (_progressOffsets[p] != 0)
+        {
+            putU32(_packet + _progressOffsets[p], progress);
+        }
+    }
+
+    _udp.beginPacket(_destination, _port);
+    _udp.write(_packet, _length);
+    if (_udp.endPacket())
+    {
+        packetsSent++;
+    }
+    _publishedAt = millis();
+}
+
+uint32_t SpotifyGateway::artKey() const
+{
+    return _artKey;
+}
+
+bool SpotifyGateway::serveArt(Client &client, Stream &art, long length)
+{
+    client.setTimeout(SPOTIFY_TIMEOUT);
+    char line[24];
+    size_t n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = 0;
+
+    if (strncmp(line, "ART ", 4) != 0 || _artKey == 0 || strtoul(line + 4, NULL, 16) != _artKey || length <= 0)
+    {
+        client.print("NO\n");
+        client.stop();
+        return false;
+    }
+
+    client.print("OK ");
+    client.print(length);
+    client.print("\n");
+
+    uint8_t buff[128];
+    long sent = 0;
+    while (sent < length)
+    {
+        size_t want = (length - sent > (long)sizeof(buff)) ? sizeof(buff) : length - sent;
+        size_t got = art.readBytes(buff, want);
+        if (got == 0 || client.write(buff, got) != got)
+        {
+            break;
+        }
+        sent += got;
+        yield();
+    }
+    client.stop();
+    return sent == length;
+}
+
+SpotifySubscriber::SpotifySubscriber(UDP &udp) : _udp(udp)
+{
+    _heard = false;
+    _sequence = 0;
+    _contentHash = 0;
+    _artKey = 0;
+    _receivedAt = 0;
+    memset(&currentlyPlaying, 0, sizeof(currentlyPlaying));
+    memset(&playerDetails, 0, sizeof(playerDetails));
+    currentlyPlaying.error = true;
+    playerDetails.error = true;
+}
+
+bool SpotifySubscriber::loop()
+{
+    bool changed = false;
+    uint8_t packet[SPOTIFY_GATEWAY_PACKET_SIZE];
+    while (_udp.parsePacket() > 0)
+    {
+        int length = _udp.read(packet, sizeof(packet));
+        if (length > 0 && decode(packet, length))
+        {
+            _gateway = _udp.remoteIP();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool SpotifySubscriber::decode(const uint8_t *packet, size_t length)
+{
+    SpotifyPacketReader r = {packet, length, 0, false};
+    if (r.u8() != 'S' || r.u8() != 'P' || r.u8() != 'G' || r.u8() != 'W' || r.u8() != SPOTIFY_GATEWAY_VERSION)
+    {
+        return false;
+    }
+    uint8_t flags = r.u8();
+    uint32_t sequence = r.u32();
+    uint32_t contentHash = r.u32();
+    uint32_t artKey = r.u32();
+
+    // Packets can arrive out of order, a gateway that restarted is picked
+    // up again once the old one has timed out
+    if (connected() && (int32_t)(sequence - _sequence) <= 0)
+    {
+        return false;
+    }
+
+    // Decoded on the side so a bad packet doesn't leave half of it behind
+    CurrentlyPlaying playing;
+    PlayerDetails player;
+    memset(&playing, 0, sizeof(playing));
+    memset(&player, 0, sizeof(player));
+    playing.error = true;
+    player.error = true;
+
+    if (flags & gateway_has_currently_playing)
+    {
+        playing.type = (SpotifyPlayingType)r.u8();
+        playing.isPlaying = r.u8();
+        playing.progressMs = r.u32();
+        playing.duraitonMs = r.u32();
+        r.str(playing.trackName, sizeof(playing.trackName));
+        r.str(playing.trackUri, sizeof(playing.trackUri));
+        r.str(playing.firstArtistName, sizeof(playing.firstArtistName));
+#ifndef SPOTIFY_NO_URIS
+        r.str(playing.firstArtistUri, sizeof(playing.firstArtistUri));
+#else
+        r.str(NULL, 0);
+#endif
+#ifndef SPOTIFY_NO_ALBUM_NAME
+        r.str(playing.albumName, sizeof(playing.albumName));
+#else
+        r.str(NULL, 0);
+#endif
+#ifndef SPOTIFY_NO_URIS
+        r.str(playing.albumUri, sizeof(playing.albumUri));
+#else
+        r.str(NULL, 0);
+#endif
+        r.str(playing.imgUrl, sizeof(playing.imgUrl));
+        playing.error = false;
+    }
+    if (flags & gateway_has_player_details)
+    {
+        player.isPlaying = r.u8();
+        player.repeateState = (RepeatOptions)r.u8();
+        player.shuffleState = r.u8();
+        player.progressMs = r.u32();
+        r.str(player.device.id, sizeof(player.device.id));
+        r.str(player.device.name, sizeof(player.device.name));
+        r.str(player.device.type, sizeof(player.device.type));
+        player.device.isActive = r.u8();
+        player.device.isRestricted = r.u8();
+        player.device.isPrivateSession = r.u8();
+        player.device.volumePercent = r.u8();
+        player.error = false;
+    }
+    if (r.overflow)
+    {
+        return false;
+    }
+
+    bool changed = !_heard || contentHash != _contentHash;
+    currentlyPlaying = playing;
+    playerDetails = player;
+    _sequence = sequence;
+    _contentHash = contentHash;
+    _artKey = artKey;
+    _heard = true;
+    _receivedAt = millis();
+    return changed;
+}
+
+bool SpotifySubscriber::connected() const
+{
+    return _heard && millis() - _receivedAt < SPOTIFY_GATEWAY_TIMEOUT_MS;
+}
+
+IPAddress SpotifySubscriber::gatewayIP() const
+{
+    return _gateway;
+}
+
+long SpotifySubscriber::progressMs() const
+{
+    if (currentlyPlaying.error)
+    {
+        return playerDetails.progressMs;
+    }
+    long progress = currentlyPlaying.progressMs;
+    if (currentlyPlaying.isPlaying)
+    {
+        progress += millis() - _receivedAt;
+        if (currentlyPlaying.duraitonMs > 0 && progress > currentlyPlaying.duraitonMs)
+        {
+            progress = currentlyPlaying.duraitonMs;
+        }
+    }
+    return progress;
+}
+
+uint32_t SpotifySubscriber::artKey() const
+{
+    return _artKey;
+}
+
+bool SpotifySubscriber::getImage(Client &client, Stream *file, uint16_t port)
+{
+    if (!connected() || _artKey == 0 || !client.connect(_gateway, port))
+    {
+        return false;
+    }
+
+    char line[24];
+    snprintf(line, sizeof(line), "ART %08lx\n", (unsigned long)_artKey);
+    client.print(line);
+
+    client.setTimeout(SPOTIFY_TIMEOUT);
+    size_t n = client.readBytesUntil('\n', line, sizeof(line) - 1);
+    line[n] = 0;
+    long length = (strncmp(line, "OK ", 3) == 0) ? atol(line + 3) : 0;
+
+    uint8_t buff[128];
+    long received = 0;
+    while (received < length)
+    {
+        size_t want = (length - received > (long)sizeof(buff)) ? sizeof(buff) : length - received;
+        size_t got = client.readBytes(buff, want);
+        if (got == 0 || file->write(buff, got) != got)
+        {
+            break;
+        }
+        received += got;
+        yield();
+    }
+    client.stop();
+    return length > 0 && received == length;
+}
@@ -0,0 +1,156 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyGateway_h
+#define ArduinoSpotifyGateway_h
+
+#include <Arduino.h>
+#include <Client.h>
+#include <Udp.h>
+#include "ArduinoSpotify.h"
+
+// One board polls Spotify and shares what's playing with the rest of
+// the displays on the LAN, so the account sees one poller however many
+// displays there are. Not included by ArduinoSpotify.h.
+//
+// Snapshots go out as UDP packets to a multicast group (or broadcast
+// address), whenever something changes and every
+// SPOTIFY_GATEWAY_REPEAT_MS so displays that join late or miss one
+// catch up. The album art is fetched from the gateway over TCP.
+//
+// Snapshot packet, numbers little endian, strings are a length byte
+// then the characters:
+//   "SPGW", version, flags (1 = currently playing, 2 = player details)
+//   uint32 sequence, uint32 content hash (of everything but the
+//   sequence and progress), uint32 art key (spotifyHash() of imgUrl)
+//   currently playing: type, isPlaying, uint32 progressMs,
+//     uint32 durationMs, trackName, trackUri, firstArtistName,
+//     firstArtistUri, albumName, albumUri, imgUrl
+//   player details: isPlaying, repeat, shuffle, uint32 progressMs,
+//     device id, name, type, isActive, isRestricted,
+//     isPrivateSession, volumePercent
+// Fields compiled out with SPOTIFY_NO_URIS/SPOTIFY_NO_ALBUM_NAME are
+// sent empty, so both ends don't need the same flags.
+//
+// Art request: "ART <key in hex>\n", answered with "OK <length>\n" and
+// the image, or "NO\n" if the gateway has different art by now.
+
+#ifndef SPOTIFY_GATEWAY_PORT
+#define SPOTIFY_GATEWAY_PORT 42420
+#endif
+
+// How often an unchanged snapshot is sent again
+#ifndef SPOTIFY_GATEWAY_REPEAT_MS
+#define SPOTIFY_GATEWAY_REPEAT_MS 2000
+#endif
+
+// Subscribers give up on a gateway they haven't heard from for this long
+#ifndef SPOTIFY_GATEWAY_TIMEOUT_MS
+#define SPOTIFY_GATEWAY_TIMEOUT_MS 10000
+#endif
+
+#define SPOTIFY_GATEWAY_VERSION 1
+#define SPOTIFY_GATEWAY_PACKET_SIZE 640
+
+struct SpotifyPacketWriter;
+
+class SpotifyGateway
+{
+public:
+  // udp only needs to be able to send, the destination is usually a
+  // multicast group like 239.255.42.42
+  SpotifyGateway(ArduinoSpotify &spotify, UDP &udp, IPAddress destination, uint16_t port = SPOTIFY_GATEWAY_PORT);
+
+  // Polls Spotify every pollMs with getPlayerState() and publishes the
+  // result. Returns true if it published a snapshot that changed.
+  bool loop(unsigned long pollMs = 5000);
+  // Sends the current snapshot straight away
+  void publish();
+
+  // Key of the art in the last snapshot, download the new art and pass
+  // it to serveArt() when this changes
+  uint32_t artKey() const;
+  // Answers an art request from a subscriber on the client a server
+  // accepted, with art/length being the image for artKey()
+  bool serveArt(Client &client, Stream &art, long length);
+
+  unsigned long packetsSent;
+  unsigned long polls;
+
+private:
+  // false if the snapshot doesn't fit, the last good one is kept
+  bool encode();
+  void writeSnapshot(SpotifyPacketWriter &w, size_t *progressOffsets);
+
+  ArduinoSpotify &_spotify;
+  UDP &_udp;
+  IPAddress _destination;
+  uint16_t _port;
+  // The last good snapshot, sent again with the sequence and progress
+  // updated until the next poll that works
+  uint8_t _packet[SPOTIFY_GATEWAY_PACKET_SIZE];
+  size_t _length;
+  size_t _progressOffsets[2];
+  uint32_t _sequence;
+  uint32_t _artKey;
+  long _progressMs;
+  bool _playing;
+  unsigned long _snapshotAt;
+  unsigned long _polledAt;
+  unsigned long _publishedAt;
+};
+
+class SpotifySubscriber
+{
+public:
+  // udp has to be listening on the gateway's port (and have joined the
+  // multicast group if it's sent to one)
+  SpotifySubscriber(UDP &udp);
+
+  // Reads any waiting snapshots, true if one changed the structs
+  bool loop();
+  // Heard from a gateway in the last SPOTIFY_GATEWAY_TIMEOUT_MS
+  bool connected() const;
+  IPAddress gatewayIP() const;
+
+  // Progress extrapolated since the last snapshot
+  long progressMs() const;
+  uint32_t artKey() const;
+
+  // Downloads the art in the current snapshot from the gateway
+  bool getImage(Client &client, Stream *file, uint16_t port = SPOTIFY_GATEWAY_PORT);
+
+  // Same as ArduinoSpotify's, error is set until a snapshot arrives
+  struct CurrentlyPlaying currentlyPlaying;
+  struct PlayerDetails playerDetails;
+
+private:
+  bool decode(const uint8_t *packet, size_t length);
+
+  UDP &_udp;
+  IPAddress _gateway;
+  bool _heard;
+  uint32_t _sequence;
+  uint32_t _contentHash;
+  uint32_t _artKey;
+  unsigned long _receivedAt;
+};
+
+#endif
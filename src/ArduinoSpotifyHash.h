@@ -0,0 +1,40 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyHash_h
+#define ArduinoSpotifyHash_h
+
+#include <Arduino.h>
+
+// 32 bit FNV-1a of a string. Used to tell if a uri or url changed and
+// as the key for anything cached from one (art colours, beat files,
+// gateway art), plenty for that and cheap to keep.
+inline uint32_t spotifyHash(const char *text)
+{
+  uint32_t hash = 2166136261UL;
+  while (*text)
+  {
+    hash ^= (uint8_t)*text++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+#endif
@@ -0,0 +1,446 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#include "ArduinoSpotifyJson.h"
+
+SpotifyJsonScanner::SpotifyJsonScanner(SpotifyJsonHandler handler, void *context)
+{
+    _handler = handler;
+    _context = context;
+    reset();
+}
+
+void SpotifyJsonScanner::reset()
+{
+    _state = state_value;
+    _closeAllowed = false;
+    _inKey = false;
+    _stopped = false;
+    _depth = 0;
+    _unicodeDigits = 0;
+    _unicode = 0;
+    _bytesRead = 0;
+    _valueLength = 0;
+    _value[0] = 0;
+}
+
+bool SpotifyJsonScanner::parse(Stream &in, long length)
+{
+    char buff[64];
+    while (length != 0)
+    {
+        // Asking for what's there already means readBytes() only waits
+        // on its timeout when nothing has arrived yet
+        size_t wanted = in.available();
+        if (wanted < 1)
+        {
+            wanted = 1;
+        }
+        if (wanted > sizeof(buff))
+        {
+            wanted = sizeof(buff);
+        }
+        if (length > 0 && (long)wanted > length)
+        {
+            wanted = length;
+        }
+
+        size_t got = in.readBytes(buff, wanted);
+        if (got == 0)
+        {
+            break;
+        }
+        if (length > 0)
+        {
+            length -= got;
+        }
+        for (size_t i = 0; i < got; i++)
+        {
+            if (!feed(buff[i]))
+            {
+                return done();
+            }
+        }
+    }
+
+    // A number at the very end has nothing after it to finish it
+    if (_state == state_number && _depth == 0)
+    {
+        feed(' ');
+    }
+    return done();
+}
+
+bool SpotifyJsonScanner::feed(char c)
+{
+    if (_stopped || _state == state_done || _state == state_failed)
+    {
+        return false;
+    }
+    _bytesRead++;
+
+    // Some states end on a character that belongs to the next one
+    while (true)
+    {
+        switch (_state)
+        {
+        case state_value:
+            if (isspace((unsigned char)c))
+            {
+                return true;
+            }
+            if (c == ']' && _closeAllowed)
+            {
+                _closeAllowed = false;
+                _state = state_after_value;
+                continue;
+            }
+            _closeAllowed = false;
+            if (c == '{' || c == '[')
+            {
+                emit(c == '{' ? spotify_json_object_start : spotify_json_array_start, NULL);
+                if (!push(c))
+                {
+                    return false;
+                }
+                _closeAllowed = true;
+                _state = (c == '{') ? state_key : state_value;
+            }
+            else if (c == '"')
+            {
+                _valueLength = 0;
+                _inKey = false;
+                _state = state_string;
+            }
+            else if (c == '-' || isdigit((unsigned char)c))
+            {
+                _valueLength = 0;
+                appendValue(c);
+                _state = state_number;
+            }
+            else if (c == 't' || c == 'f' || c == 'n')
+            {
+                _valueLength = 0;
+                appendValue(c);
+                _state = state_literal;
+            }
+            else
+            {
+                _state = state_failed;
+            }
+            break;
+
+        case state_key:
+            if (isspace((unsigned char)c))
+            {
+                return true;
+            }
+            if (c == '}' && _closeAllowed)
+            {
+                _closeAllowed = false;
+                _state = state_after_value;
+                continue;
+            }
+            _closeAllowed = false;
+            if (c == '"')
+            {
+                _valueLength = 0;
+                _inKey = true;
+                _state = state_string;
+            }
+            else
+            {
+                _state = state_failed;
+            }
+            break;
+
+        case state_colon:
+            if (isspace((unsigned char)c))
+            {
+                return true;
+            }
+            _state = (c == ':') ? state_value : state_failed;
+            break;
+
+        case state_after_value:
+            if (isspace((unsigned char)c))
+            {
+                return true;
+            }
+            if (_depth == 0)
+            {
+                _state = state_failed;
+            }
+            else if (c == ',')
+            {
+                if (_types[_depth - 1] == '{')
+                {
+                    _state = state_key;
+                }
+                else
+                {
+                    _indices[_depth - 1]++;
+                    _state = state_value;
+                }
+            }
+            else if ((c == '}' || c == ']') && _types[_depth - 1] == ((c == '}') ? '{' : '['))
+            {
+                _depth--;
+                emit(c == '}' ? spotify_json_object_end : spotify_json_array_end, NULL);
+                finishValue();
+            }
+            else
+            {
+                _state = state_failed;
+            }
+            break;
+
+        case state_string:
+            if (c == '\\')
+            {
+                _state = state_escape;
+            }
+            else if (c == '"')
+            {
+                _value[_valueLength] = 0;
+                if (_inKey)
+                {
+                    strncpy(_keys[_depth - 1], _value, SPOTIFY_JSON_SCAN_KEY_SIZE - 1);
+                    _keys[_depth - 1][SPOTIFY_JSON_SCAN_KEY_SIZE - 1] = 0;
+                    _state = state_colon;
+                }
+                else
+                {
+                    emit(spotify_json_string, _value);
+                    finishValue();
+                }
+            }
+            else
+            {
+                appendValue(c);
+            }
+            break;
+
+        case state_escape:
+            _state = state_string;
+            switch (c)
+            {
+            case 'b':
+                appendValue('\b');
+                break;
+            case 'f':
+                appendValue('\f');
+                break;
+            case 'n':
+                appendValue('\n');
+                break;
+            case 'r':
+                appendValue('\r');
+                break;
+            case 't':
+                appendValue('\t');
+                break;
+            case 'u':
+                _unicode = 0;
+                _unicodeDigits = 0;
+                _state = state_unicode;
+                break;
+            default:
+                // \" \\ \/
+                appendValue(c);
+                break;
+            }
+            break;
+
+        case state_unicode:
+            if (!isxdigit((unsigned char)c))
+            {
+                _state = state_failed;
+                break;
+            }
+            _unicode = (_unicode << 4) | (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+            if (++_unicodeDigits == 4)
+            {
+                appendUtf8(_unicode);
+                _state = state_string;
+            }
+            break;
+
+        case state_number:
+            if (isdigit((unsigned char)c) || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+            {
+                appendValue(c);
+                return true;
+            }
+            _value[_valueLength] = 0;
+            emit(spotify_json_number, _value);
+            finishValue();
+            if (_stopped)
+            {
+                return false;
+            }
+            continue;
+
+        case state_literal:
+            if (isalpha((unsigned char)c))
+            {
+                appendValue(c);
+                return true;
+            }
+            _value[_valueLength] = 0;
+            if (strcmp(_value, "true") == 0 || strcmp(_value, "false") == 0)
+            {
+                emit(spotify_json_bool, _value);
+            }
+            else if (strcmp(_value, "null") == 0)
+            {
+                emit(spotify_json_null, NULL);
+            }
+            else
+            {
+                _state = state_failed;
+                return false;
+            }
+            finishValue();
+            if (_stopped)
+            {
+                return false;
+            }
+            continue;
+
+        default:
+            return false;
+        }
+        break;
+    }
+    return !_stopped && _state != state_done && _state != state_failed;
+}
+
+bool SpotifyJsonScanner::push(char type)
+{
+    if (_depth >= SPOTIFY_JSON_SCAN_DEPTH)
+    {
+        _state = state_failed;
+        return false;
+    }
+    _types[_depth] = type;
+    _keys[_depth][0] = 0;
+    _indices[_depth] = (type == '[') ? 0 : -1;
+    _depth++;
+    return true;
+}
+
+void SpotifyJsonScanner::finishValue()
+{
+    _state = (_depth == 0) ? state_done : state_after_value;
+}
+
+void SpotifyJsonScanner::emit(SpotifyJsonType type, const char *value)
+{
+    if (_handler != NULL && !_stopped)
+    {
+        _handler(*this, type, value, _context);
+    }
+}
+
+void SpotifyJsonScanner::appendValue(char c)
+{
+    if (_valueLength < SPOTIFY_JSON_SCAN_VALUE_SIZE - 1)
+    {
+        _value[_valueLength++] = c;
+    }
+}
+
+void SpotifyJsonScanner::appendUtf8(uint16_t codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        appendValue(codepoint);
+    }
+    else if (codepoint < 0x800)
+    {
+        appendValue(0xC0 | (codepoint >> 6));
+        appendValue(0x80 | (codepoint & 0x3F));
+    }
+    else if (codepoint >= 0xD800 && codepoint <= 0xDFFF)
+    {
+        // Half of a surrogate pair, not worth the RAM to join them up
+        appendValue('?');
+    }
+    else
+    {
+        appendValue(0xE0 | (codepoint >> 12));
+        appendValue(0x80 | ((codepoint >> 6) & 0x3F));
+        appendValue(0x80 | (codepoint & 0x3F));
+    }
+}
+
+void SpotifyJsonScanner::stop()
+{
+    _stopped = true;
+}
+
+bool SpotifyJsonScanner::done() const
+{
+    return _state == state_done;
+}
+
+bool SpotifyJsonScanner::failed() const
+{
+    return _state == state_failed;
+}
+
+bool SpotifyJsonScanner::stopped() const
+{
+    return _stopped;
+}
+
+unsigned long SpotifyJsonScanner::bytesRead() const
+{
+    return _bytesRead;
+}
+
+uint8_t SpotifyJsonScanner::depth() const
+{
+    return _depth;
+}
+
+const char *SpotifyJsonScanner::key(uint8_t level) const
+{
+    if (level >= _depth || _types[level] != '{')
+    {
+        return "";
+    }
+    return _keys[level];
+}
+
+int SpotifyJsonScanner::index(uint8_t level) const
+{
+    if (level >= _depth || _types[level] != '[')
+    {
+        return -1;
+    }
+    return _indices[level];
+}
+
+bool SpotifyJsonScanner::keyIs(uint8_t level, const char *name) const
+{
+    return strcmp(key(level), name) == 0;
+}
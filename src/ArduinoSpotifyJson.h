@@ -0,0 +1,140 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyJson_h
+#define ArduinoSpotifyJson_h
+
+#include <Arduino.h>
+
+// Deepest nesting SpotifyJsonScanner can follow
+#ifndef SPOTIFY_JSON_SCAN_DEPTH
+#define SPOTIFY_JSON_SCAN_DEPTH 10
+#endif
+
+// Longest key kept for each level, longer ones are cut short
+#ifndef SPOTIFY_JSON_SCAN_KEY_SIZE
+#define SPOTIFY_JSON_SCAN_KEY_SIZE 20
+#endif
+
+// Longest value passed to the handler, longer ones are cut short
+#ifndef SPOTIFY_JSON_SCAN_VALUE_SIZE
+#define SPOTIFY_JSON_SCAN_VALUE_SIZE 96
+#endif
+
+enum SpotifyJsonType
+{
+  spotify_json_string,
+  spotify_json_number,
+  spotify_json_bool,
+  spotify_json_null,
+  spotify_json_object_start,
+  spotify_json_object_end,
+  spotify_json_array_start,
+  spotify_json_array_end
+};
+
+class SpotifyJsonScanner;
+
+// value is the text of strings, numbers and bools ("true"/"false"), it
+// only lives until the handler returns
+typedef void (*SpotifyJsonHandler)(SpotifyJsonScanner &scanner, SpotifyJsonType type, const char *value, void *context);
+
+// Walks through a JSON document one character at a time and calls the
+// handler for every value, for responses that are far too big for a
+// JsonDocument (audio analysis, search results). Only the path to the
+// current value is kept, the handler picks out what it needs with
+// depth(), key() and index().
+//
+// For {"beats": [{"start": 0.5}]} the handler gets the number "0.5" with
+// depth() 3, key(0) "beats", index(1) 0 and key(2) "start". Container
+// start and end events come with the path of the container itself.
+class SpotifyJsonScanner
+{
+public:
+  SpotifyJsonScanner(SpotifyJsonHandler handler, void *context = NULL);
+
+  // Clears everything, ready for a new document
+  void reset();
+
+  // Reads the document from the stream (up to length bytes if it's
+  // known), returns true once a complete document has been read
+  bool parse(Stream &in, long length = -1);
+
+  // For when the bytes come from somewhere else, returns false once the
+  // document is complete, the handler stopped it or it isn't valid JSON
+  bool feed(char c);
+
+  // Lets the handler end the scan early, e.g. once it has what it needs
+  void stop();
+
+  bool done() const;
+  bool failed() const;
+  bool stopped() const;
+  unsigned long bytesRead() const;
+
+  // Number of containers the current value is in
+  uint8_t depth() const;
+  // Key of the current member of the object at this level, "" for arrays
+  const char *key(uint8_t level) const;
+  // Position in the array at this level, -1 for objects
+  int index(uint8_t level) const;
+  // True if the value is the member `name` of the object at this level
+  bool keyIs(uint8_t level, const char *name) const;
+
+private:
+  enum State
+  {
+    state_value,
+    state_key,
+    state_colon,
+    state_after_value,
+    state_string,
+    state_escape,
+    state_unicode,
+    state_number,
+    state_literal,
+    state_done,
+    state_failed
+  };
+
+  bool push(char type);
+  void finishValue();
+  void emit(SpotifyJsonType type, const char *value);
+  void appendValue(char c);
+  void appendUtf8(uint16_t codepoint);
+
+  SpotifyJsonHandler _handler;
+  void *_context;
+  State _state;
+  bool _closeAllowed;
+  bool _inKey;
+  bool _stopped;
+  uint8_t _depth;
+  uint8_t _unicodeDigits;
+  uint16_t _unicode;
+  unsigned long _bytesRead;
+  char _types[SPOTIFY_JSON_SCAN_DEPTH];
+  char _keys[SPOTIFY_JSON_SCAN_DEPTH][SPOTIFY_JSON_SCAN_KEY_SIZE];
+  int _indices[SPOTIFY_JSON_SCAN_DEPTH];
+  char _value[SPOTIFY_JSON_SCAN_VALUE_SIZE];
+  uint8_t _valueLength;
+};
+
+#endif
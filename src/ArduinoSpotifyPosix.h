@@ -0,0 +1,479 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyPosix_h
+#define ArduinoSpotifyPosix_h
+
+// A Client for running the library on a Linux (or other POSIX) host, so
+// a service on a small Linux box can use exactly the parsing code the
+// boards do. It's a plain TCP socket with OpenSSL on top, link with
+// -lssl -lcrypto, or define SPOTIFY_POSIX_NO_TLS for plain TCP only.
+// Not included by ArduinoSpotify.h, and the host build still needs
+// something providing the Arduino Stream/Client/millis() API.
+//
+// Requests block like they do on the boards. Many accounts can share
+// one ArduinoSpotify and one of these through the sessions (addSession()
+// and nextSession()), the client is reconnected for every request.
+
+#if !defined(__unix__) && !defined(__APPLE__)
+#error ArduinoSpotifyPosix.h is for host builds with POSIX sockets
+#endif
+
+#include <Arduino.h>
+#include <Client.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef SPOTIFY_POSIX_NO_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+class SpotifyPosixClient : public Client
+{
+public:
+  SpotifyPosixClient(bool tls = true)
+      : _fd(-1), _closed(true), _tls(tls), _insecure(false), _caFile(NULL),
+        _redirectHost(NULL), _redirectPort(0), _start(0), _end(0)
+  {
+#ifndef SPOTIFY_POSIX_NO_TLS
+    _ctx = NULL;
+    _ssl = NULL;
+#endif
+  }
+
+  ~SpotifyPosixClient()
+  {
+    stop();
+#ifndef SPOTIFY_POSIX_NO_TLS
+    resetContext();
+#endif
+  }
+
+  // Skips checking the server's certificate, e.g. for a local test server
+  void setInsecure()
+  {
+    _insecure = true;
+#ifndef SPOTIFY_POSIX_NO_TLS
+    resetContext();
+#endif
+  }
+
+  // CA certificates to check the server against (PEM file), by default
+  // the system's are used
+  void setCACertFile(const char *path)
+  {
+    _caFile = path;
+#ifndef SPOTIFY_POSIX_NO_TLS
+    resetContext();
+#endif
+  }
+
+  // Sends every connection to this host and port instead, e.g. a local
+  // stand-in for the API. TLS still asks for the original host name.
+  // NULL goes back to connecting where asked.
+  void redirect(const char *host, uint16_t port)
+  {
+    _redirectHost = host;
+    _redirectPort = port;
+  }
+
+  int connect(IPAddress ip, uint16_t port)
+  {
+    char host[16];
+    snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    return connect(host, port);
+  }
+
+  int connect(const char *host, uint16_t port)
+  {
+    stop();
+
+    const char *target = (_redirectHost != NULL) ? _redirectHost : host;
+    char service[6];
+    snprintf(service, sizeof(service), "%u", (_redirectHost != NULL) ? _redirectPort : port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = NULL;
+    if (getaddrinfo(target, service, &hints, &addresses) != 0)
+    {
+      return 0;
+    }
+
+    // Non-blocking so the connect can time out
+    for (struct addrinfo *a = addresses; a != NULL && _fd < 0; a = a->ai_next)
+    {
+      int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd < 0)
+      {
+        continue;
+      }
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+      _fd = fd;
+      if (::connect(fd, a->ai_addr, a->ai_addrlen) != 0 &&
+          (errno != EINPROGRESS || !waitFor(POLLOUT, _timeout) || socketError() != 0))
+      {
+        ::close(fd);
+        _fd = -1;
+      }
+    }
+    freeaddrinfo(addresses);
+    if (_fd < 0)
+    {
+      return 0;
+    }
+
+    // Requests go out a line at a time
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    _closed = false;
+
+#ifndef SPOTIFY_POSIX_NO_TLS
+    if (_tls && !startTls(host))
+    {
+      stop();
+      return 0;
+    }
+#endif
+    return 1;
+  }
+
+  size_t write(uint8_t c)
+  {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t *buf, size_t size)
+  {
+    size_t written = 0;
+    while (_fd >= 0 && written < size)
+    {
+      int sent;
+      short waitEvent = POLLOUT;
+#ifndef SPOTIFY_POSIX_NO_TLS
+      if (_ssl != NULL)
+      {
+        sent = SSL_write(_ssl, buf + written, size - written);
+        if (sent <= 0)
+        {
+          int error = SSL_get_error(_ssl, sent);
+          if (error == SSL_ERROR_WANT_READ)
+          {
+            waitEvent = POLLIN;
+          }
+          else if (error != SSL_ERROR_WANT_WRITE)
+          {
+            break;
+          }
+        }
+      }
+      else
+#endif
+      {
+        sent = send(_fd, buf + written, size - written, MSG_NOSIGNAL);
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+          break;
+        }
+      }
+
+      if (sent > 0)
+      {
+        written += sent;
+      }
+      else if (!waitFor(waitEvent, _timeout))
+      {
+        break;
+      }
+    }
+    return written;
+  }
+
+  int available()
+  {
+    fill(0);
+    return _end - _start;
+  }
+
+  // Waits up to the stream timeout for data, like reads from the
+  // boards' clients effectively do through readBytes()
+  int read()
+  {
+    if (!fill(_timeout))
+    {
+      return -1;
+    }
+    return _buffer[_start++];
+  }
+
+  int read(uint8_t *buf, size_t size)
+  {
+    if (!fill(_timeout))
+    {
+      return -1;
+    }
+    size_t count = _end - _start;
+    if (count > size)
+    {
+      count = size;
+    }
+    memcpy(buf, _buffer + _start, count);
+    _start += count;
+    return count;
+  }
+
+  int peek()
+  {
+    if (!fill(0))
+    {
+      return -1;
+    }
+    return _buffer[_start];
+  }
+
+  void flush()
+  {
+  }
+
+  void stop()
+  {
+#ifndef SPOTIFY_POSIX_NO_TLS
+    if (_ssl != NULL)
+    {
+      SSL_shutdown(_ssl);
+      SSL_free(_ssl);
+      _ssl = NULL;
+    }
+#endif
+    if (_fd >= 0)
+    {
+      ::close(_fd);
+      _fd = -1;
+    }
+    _closed = true;
+    _start = 0;
+    _end = 0;
+  }
+
+  // Still connected while there's unread data, like the boards' clients
+  uint8_t connected()
+  {
+    fill(0);
+    return _end > _start || (_fd >= 0 && !_closed);
+  }
+
+  operator bool()
+  {
+    return _fd >= 0;
+  }
+
+private:
+  bool waitFor(short events, unsigned long timeoutMs)
+  {
+    struct pollfd p;
+    p.fd = _fd;
+    p.events = events;
+    p.revents = 0;
+    int ready;
+    do
+    {
+      ready = poll(&p, 1, (int)timeoutMs);
+    } while (ready < 0 && errno == EINTR);
+    return ready > 0;
+  }
+
+  int socketError()
+  {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    return error;
+  }
+
+  // > 0 bytes read, 0 if the connection is closed, -1 if there is
+  // nothing yet
+  int receive(uint8_t *buf, size_t size)
+  {
+#ifndef SPOTIFY_POSIX_NO_TLS
+    if (_ssl != NULL)
+    {
+      int got = SSL_read(_ssl, buf, size);
+      if (got > 0)
+      {
+        return got;
+      }
+      int error = SSL_get_error(_ssl, got);
+      return (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) ? -1 : 0;
+    }
+#endif
+    ssize_t got = recv(_fd, buf, size, 0);
+    if (got >= 0)
+    {
+      return got;
+    }
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? -1 : 0;
+  }
+
+  // Makes sure there is something in the buffer, waiting up to waitMs
+  bool fill(unsigned long waitMs)
+  {
+    if (_end > _start)
+    {
+      return true;
+    }
+    _start = 0;
+    _end = 0;
+    if (_fd < 0 || _closed)
+    {
+      return false;
+    }
+
+    unsigned long started = millis();
+    while (true)
+    {
+      int got = receive(_buffer, sizeof(_buffer));
+      if (got > 0)
+      {
+        _end = got;
+        return true;
+      }
+      if (got == 0)
+      {
+        _closed = true;
+        return false;
+      }
+      unsigned long waited = millis() - started;
+      if (waited >= waitMs || !waitFor(POLLIN, waitMs - waited))
+      {
+        return false;
+      }
+    }
+  }
+
+#ifndef SPOTIFY_POSIX_NO_TLS
+  void resetContext()
+  {
+    if (_ctx != NULL)
+    {
+      SSL_CTX_free(_ctx);
+      _ctx = NULL;
+    }
+  }
+
+  bool startTls(const char *host)
+  {
+    if (_ctx == NULL)
+    {
+      _ctx = SSL_CTX_new(TLS_client_method());
+      if (_ctx == NULL)
+      {
+        return false;
+      }
+      if (_insecure)
+      {
+        SSL_CTX_set_verify(_ctx, SSL_VERIFY_NONE, NULL);
+      }
+      else
+      {
+        SSL_CTX_set_verify(_ctx, SSL_VERIFY_PEER, NULL);
+        bool loaded = (_caFile != NULL) ? SSL_CTX_load_verify_locations(_ctx, _caFile, NULL)
+                                        : SSL_CTX_set_default_verify_paths(_ctx);
+        if (!loaded)
+        {
+          resetContext();
+          return false;
+        }
+      }
+    }
+
+    _ssl = SSL_new(_ctx);
+    if (_ssl == NULL)
+    {
+      return false;
+    }
+    SSL_set_fd(_ssl, _fd);
+    SSL_set_tlsext_host_name(_ssl, host);
+    if (!_insecure)
+    {
+      SSL_set1_host(_ssl, host);
+    }
+
+    unsigned long started = millis();
+    while (true)
+    {
+      int result = SSL_connect(_ssl);
+      if (result == 1)
+      {
+        return true;
+      }
+      int error = SSL_get_error(_ssl, result);
+      short waitEvent;
+      if (error == SSL_ERROR_WANT_READ)
+      {
+        waitEvent = POLLIN;
+      }
+      else if (error == SSL_ERROR_WANT_WRITE)
+      {
+        waitEvent = POLLOUT;
+      }
+      else
+      {
+        return false;
+      }
+      unsigned long waited = millis() - started;
+      if (waited >= _timeout || !waitFor(waitEvent, _timeout - waited))
+      {
+        return false;
+      }
+    }
+  }
+
+  SSL_CTX *_ctx;
+  SSL *_ssl;
+#endif
+
+  int _fd;
+  bool _closed;
+  bool _tls;
+  bool _insecure;
+  const char *_caFile;
+  const char *_redirectHost;
+  uint16_t _redirectPort;
+  uint8_t _buffer[1024];
+  size_t _start;
+  size_t _end;
+};
+
+#endif
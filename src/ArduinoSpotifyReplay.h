@@ -0,0 +1,154 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyReplay_h
+#define ArduinoSpotifyReplay_h
+
+#include <Arduino.h>
+#include <Client.h>
+
+// Clients for capturing real responses and playing them back, e.g. to
+// benchmark the parsing against a corpus of responses (see the
+// replayBenchmark example). Not included by ArduinoSpotify.h.
+
+// Wraps the real client and copies everything it receives to a file,
+// so the file holds the raw HTTP response (status line, headers, body).
+class SpotifyRecordingClient : public Client
+{
+public:
+  SpotifyRecordingClient(Client &client) : _client(client), _recording(NULL)
+  {
+  }
+
+  // Where the next response goes, one response per file is easiest
+  void record(Print *recording)
+  {
+    _recording = recording;
+  }
+
+  int connect(IPAddress ip, uint16_t port) { return _client.connect(ip, port); }
+  int connect(const char *host, uint16_t port) { return _client.connect(host, port); }
+  size_t write(uint8_t c) { return _client.write(c); }
+  size_t write(const uint8_t *buf, size_t size) { return _client.write(buf, size); }
+  int available() { return _client.available(); }
+  int read()
+  {
+    int c = _client.read();
+    if (c >= 0 && _recording != NULL)
+    {
+      _recording->write((uint8_t)c);
+    }
+    return c;
+  }
+  int read(uint8_t *buf, size_t size)
+  {
+    int got = _client.read(buf, size);
+    if (got > 0 && _recording != NULL)
+    {
+      _recording->write(buf, got);
+    }
+    return got;
+  }
+  int peek() { return _client.peek(); }
+  void flush() { _client.flush(); }
+  void stop() { _client.stop(); }
+  uint8_t connected() { return _client.connected(); }
+  operator bool() { return (bool)_client; }
+
+private:
+  Client &_client;
+  Print *_recording;
+};
+
+// Serves a recorded response in place of a connection. Each response
+// is good for one request, set the next one before every call.
+// Use the ArduinoSpotify constructor that takes a bearer token so no
+// token refresh requests are made.
+class SpotifyReplayClient : public Client
+{
+public:
+  SpotifyReplayClient() : bytesSent(0), _next(NULL), _response(NULL)
+  {
+  }
+
+  void setResponse(Stream *response)
+  {
+    _next = response;
+  }
+
+  // Fails like an unreachable server when there is no response set
+  int connect(IPAddress ip, uint16_t port)
+  {
+    (void)ip;
+    (void)port;
+    return takeResponse();
+  }
+  int connect(const char *host, uint16_t port)
+  {
+    (void)host;
+    (void)port;
+    return takeResponse();
+  }
+
+  // Requests go nowhere, they are only counted
+  size_t write(uint8_t c)
+  {
+    (void)c;
+    bytesSent++;
+    return 1;
+  }
+  size_t write(const uint8_t *buf, size_t size)
+  {
+    (void)buf;
+    bytesSent += size;
+    return size;
+  }
+
+  int available() { return _response != NULL ? _response->available() : 0; }
+  int read() { return _response != NULL ? _response->read() : -1; }
+  int read(uint8_t *buf, size_t size)
+  {
+    if (_response == NULL)
+    {
+      return -1;
+    }
+    return _response->readBytes((char *)buf, size);
+  }
+  int peek() { return _response != NULL ? _response->peek() : -1; }
+  void flush() {}
+  void stop() { _response = NULL; }
+  uint8_t connected() { return _response != NULL && _response->available() > 0; }
+  operator bool() { return _response != NULL; }
+
+  unsigned long bytesSent;
+
+private:
+  int takeResponse()
+  {
+    _response = _next;
+    _next = NULL;
+    return _response != NULL;
+  }
+
+  Stream *_next;
+  Stream *_response;
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+// Included for the SPOTIFY_STATS flag, nothing in here gets
+// compiled unless it is set.
+#include "ArduinoSpotify.h"
+
+#ifdef SPOTIFY_STATS
+
+SpotifyRequestStats::SpotifyRequestStats()
+{
+    clear();
+}
+
+void SpotifyRequestStats::begin(uint8_t endpoint)
+{
+    // A request that never got closed is still worth keeping
+    if (_active)
+    {
+        end(false);
+    }
+
+    memset(&_current, 0, sizeof(_current));
+    _current.endpoint = endpoint;
+    _current.statusCode = -1;
+    _current.startUs = micros();
+    _active = true;
+}
+
+void SpotifyRequestStats::mark(SpotifyRequestPhase phase)
+{
+    if (!_active || phase >= SPOTIFY_NUM_PHASES)
+    {
+        return;
+    }
+    _current.phaseUs[phase] = micros() - _current.startUs;
+    _current.phasesReached |= (1 << phase);
+}
+
+void SpotifyRequestStats::setStatusCode(int statusCode)
+{
+    if (_active)
+    {
+        _current.statusCode = statusCode;
+    }
+}
+
+void SpotifyRequestStats::addSent(size_t bytes)
+{
+    if (_active)
+    {
+        _current.bytesSent += bytes;
+    }
+}
+
+void SpotifyRequestStats::addReceived(size_t bytes)
+{
+    if (_active)
+    {
+        _current.bytesReceived += bytes;
+    }
+}
+
+void SpotifyRequestStats::addSlice(size_t bytes, uint32_t us, bool overBudget)
+{
+    _slices.slices++;
+    _slices.bytes += bytes;
+    if (bytes > _slices.maxBytes)
+    {
+        _slices.maxBytes = bytes;
+    }
+    if (us > _slices.maxSliceUs)
+    {
+        _slices.maxSliceUs = us;
+    }
+    if (overBudget)
+    {
+        _slices.overBudget++;
+    }
+}
+
+void SpotifyRequestStats::addIdleSpin()
+{
+    _slices.idleSpins++;
+}
+
+void SpotifyRequestStats::end(bool bodyRead)
+{
+    if (!_active)
+    {
+        return;
+    }
+    // A request that failed on the way doesn't count towards the body
+    // phase (or the total)
+    if (bodyRead && (_current.phasesReached & (1 << spotify_phase_headers)))
+    {
+        mark(spotify_phase_body);
+    }
+    _active = false;
+
+    _records[_head] = _current;
+    _head = (_head + 1) % SPOTIFY_STATS_HISTORY;
+    if (_count < SPOTIFY_STATS_HISTORY)
+    {
+        _count++;
+    }
+}
+
+uint8_t SpotifyRequestStats::count()
+{
+    return _count;
+}
+
+const SpotifyRequestRecord &SpotifyRequestStats::get(uint8_t index)
+{
+    uint8_t oldest = (_head + SPOTIFY_STATS_HISTORY - _count) % SPOTIFY_STATS_HISTORY;
+    return _records[(oldest + index) % SPOTIFY_STATS_HISTORY];
+}
+
+SpotifyStatSummary SpotifyRequestStats::summarize(SpotifyRequestPhase phase, int endpoint)
+{
+    uint32_t durations[SPOTIFY_STATS_HISTORY];
+    uint8_t n = 0;
+    uint64_t sum = 0;
+
+    for (uint8_t i = 0; i < _count; i++)
+    {
+        const SpotifyRequestRecord &record = get(i);
+        if (endpoint >= 0 && record.endpoint != endpoint)
+        {
+            continue;
+        }
+
+        uint32_t duration;
+        if (phase == spotify_phase_total)
+        {
+            if (!(record.phasesReached & (1 << spotify_phase_body)))
+            {
+                continue;
+            }
+            duration = record.phaseUs[spotify_phase_body];
+        }
+        else
+        {
+            // Only count a phase when the one before it finished too,
+            // otherwise the duration would include the earlier phases
+            if (!(record.phasesReached & (1 << phase)))
+            {
+                continue;
+            }
+            if (phase > 0 && !(record.phasesReached & (1 << (phase - 1))))
+            {
+                continue;
+            }
+            duration = record.phaseUs[phase] - ((phase > 0) ? record.phaseUs[phase - 1] : 0);
+        }
+
+        // Insertion sort as we go, the buffer is small
+        uint8_t j = n;
+        while (j > 0 && durations[j - 1] > duration)
+        {
+            durations[j] = durations[j - 1];
+            j--;
+        }
+        durations[j] = duration;
+        sum += duration;
+        n++;
+    }
+
+    SpotifyStatSummary summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.count = n;
+    if (n > 0)
+    {
+        summary.minUs = durations[0];
+        summary.avgUs = sum / n;
+        // nearest-rank percentile
+        summary.p95Us = durations[((n * 95) + 99) / 100 - 1];
+    }
+    return summary;
+}
+
+const SpotifySliceStats &SpotifyRequestStats::slices()
+{
+    return _slices;
+}
+
+void SpotifyRequestStats::clear()
+{
+    memset(_records, 0, sizeof(_records));
+    memset(&_current, 0, sizeof(_current));
+    memset(&_slices, 0, sizeof(_slices));
+    _head = 0;
+    _count = 0;
+    _active = false;
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyStats_h
+#define ArduinoSpotifyStats_h
+
+#include <Arduino.h>
+
+// Number of requests kept in the stats ring buffer
+#ifndef SPOTIFY_STATS_HISTORY
+#define SPOTIFY_STATS_HISTORY 16
+#endif
+
+enum SpotifyEndpointId
+{
+  spotify_endpoint_other,
+  spotify_endpoint_token,
+  spotify_endpoint_currently_playing,
+  spotify_endpoint_player,
+  spotify_endpoint_player_control,
+  spotify_endpoint_devices,
+  spotify_endpoint_image
+};
+
+// Phases are in the order they happen during a request. Connect
+// includes DNS and, for secure clients, the TLS handshake as the
+// Client interface does not expose them separately.
+enum SpotifyRequestPhase
+{
+  spotify_phase_connect,    // connect() returned
+  spotify_phase_send,       // request line, headers and body written
+  spotify_phase_first_byte, // status line received
+  spotify_phase_headers,    // headers skipped/parsed
+  spotify_phase_body,       // body read and connection closed, only for requests that got that far
+  spotify_phase_total,      // only used for summaries
+  SPOTIFY_NUM_PHASES = spotify_phase_total
+};
+
+struct SpotifyRequestRecord
+{
+  uint8_t endpoint;
+  uint8_t phasesReached;                // bit per SpotifyRequestPhase
+  int16_t statusCode;
+  uint32_t startUs;                     // micros() when the request started
+  uint32_t phaseUs[SPOTIFY_NUM_PHASES]; // micros() since start at the end of each phase
+  uint32_t bytesSent;
+  uint32_t bytesReceived;
+};
+
+struct SpotifyStatSummary
+{
+  uint16_t count;
+  uint32_t minUs;
+  uint32_t avgUs;
+  uint32_t p95Us;
+};
+
+// How the budgeted read loops spent their time, totals since clear().
+// A slice is one bulk read between giving control back, an idle spin is
+// a pass that found nothing to read and waited instead.
+struct SpotifySliceStats
+{
+  uint32_t slices;
+  uint32_t bytes;
+  uint32_t maxBytes;   // most bytes read in one slice
+  uint32_t maxSliceUs; // longest slice
+  uint32_t overBudget; // slices that ran past SPOTIFY_SLICE_MS
+  uint32_t idleSpins;
+};
+
+class SpotifyRequestStats
+{
+public:
+  SpotifyRequestStats();
+
+  // Recording, used by ArduinoSpotify
+  void begin(uint8_t endpoint);
+  void mark(SpotifyRequestPhase phase);
+  void setStatusCode(int statusCode);
+  void addSent(size_t bytes);
+  void addReceived(size_t bytes);
+  void addSlice(size_t bytes, uint32_t us, bool overBudget);
+  void addIdleSpin();
+  // bodyRead is false when the request failed before its body was read
+  void end(bool bodyRead = true);
+
+  // Reading
+  uint8_t count();
+  // 0 is the oldest record still in the buffer
+  const SpotifyRequestRecord &get(uint8_t index);
+  // Duration of a single phase (or spotify_phase_total) across the
+  // buffered requests, pass -1 as the endpoint to include all of them
+  SpotifyStatSummary summarize(SpotifyRequestPhase phase, int endpoint = -1);
+  const SpotifySliceStats &slices();
+  void clear();
+
+private:
+  SpotifyRequestRecord _records[SPOTIFY_STATS_HISTORY];
+  SpotifyRequestRecord _current;
+  SpotifySliceStats _slices;
+  uint8_t _head;
+  uint8_t _count;
+  bool _active;
+};
+
+#endif
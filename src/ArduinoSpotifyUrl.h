@@ -0,0 +1,154 @@
+/*
+ArduinoSpotify - An Arduino library to wrap the Spotify API
+
+Copyright (c) 2020  Brian Lough.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+*/
+
+#ifndef ArduinoSpotifyUrl_h
+#define ArduinoSpotifyUrl_h
+
+#include <Arduino.h>
+
+// Builds a request path plus query string into a fixed size buffer.
+//
+// Parameter values are URL-encoded and the '?' / '&' separators are
+// picked automatically. If something does not fit, the buffer is left
+// as it was before the failing call, the method returns false and
+// truncated() stays set until the next setPath(), so a half written
+// URL is never sent.
+template <size_t N>
+class SpotifyUrlBuilder
+{
+public:
+  SpotifyUrlBuilder()
+  {
+    setPath("");
+  }
+
+  // Starts a new URL. The path may already contain a query string.
+  bool setPath(const char *path)
+  {
+    _buf[0] = 0;
+    _len = 0;
+    _truncated = false;
+    _hasQuery = false;
+    if (!append(path, false))
+    {
+      return false;
+    }
+    _hasQuery = (strchr(_buf, '?') != NULL);
+    return true;
+  }
+
+  // Adds an encoded segment (e.g. an id) to the path, only works before
+  // any parameters are added
+  bool appendPath(const char *segment)
+  {
+    if (_hasQuery)
+    {
+      _truncated = true;
+      return false;
+    }
+    return append(segment, true);
+  }
+
+  bool addParam(const char *name, const char *value)
+  {
+    size_t start = _len;
+    if (append(_hasQuery ? "&" : "?", false) && append(name, true) && append("=", false) && append(value, true))
+    {
+      _hasQuery = true;
+      return true;
+    }
+
+    _len = start;
+    _buf[_len] = 0;
+    return false;
+  }
+
+  bool addParam(const char *name, long value)
+  {
+    char number[12];
+    snprintf(number, sizeof(number), "%ld", value);
+    return addParam(name, number);
+  }
+
+  bool addParam(const char *name, int value)
+  {
+    return addParam(name, (long)value);
+  }
+
+  const char *c_str() const
+  {
+    return _buf;
+  }
+
+  size_t length() const
+  {
+    return _len;
+  }
+
+  bool truncated() const
+  {
+    return _truncated;
+  }
+
+  size_t capacity() const
+  {
+    return N - 1;
+  }
+
+private:
+  bool append(const char *text, bool encode)
+  {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t start = _len;
+    for (const char *p = text; *p != 0; p++)
+    {
+      char c = *p;
+      bool plain = !encode || isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~';
+      size_t needed = plain ? 1 : 3;
+      if (_len + needed > N - 1)
+      {
+        _len = start;
+        _buf[_len] = 0;
+        _truncated = true;
+        return false;
+      }
+
+      if (plain)
+      {
+        _buf[_len++] = c;
+      }
+      else
+      {
+        _buf[_len++] = '%';
+        _buf[_len++] = hex[((unsigned char)c) >> 4];
+        _buf[_len++] = hex[((unsigned char)c) & 0x0F];
+      }
+    }
+    _buf[_len] = 0;
+    return true;
+  }
+
+  char _buf[N];
+  size_t _len;
+  bool _truncated;
+  bool _hasQuery;
+};
+
+#endif